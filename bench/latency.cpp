@@ -0,0 +1,722 @@
+/*
+ * End-to-end latency benchmark of the interactive game.
+ * The real tetris binary runs under a pseudo-terminal, keys are written to
+ * it like a player would type them, and its screen output is parsed to see
+ * when the falling block moved. Per game it reports:
+ *     keypress-to-screen latency of single taps ('a', 'd' and the arrow keys
+ *     in turn)
+ *     dropped taps, which never moved the block
+ *     moves of autorepeat bursts, against the DAS/ARR rules of the game
+ *     gravity jitter, the row steps of the block against the level delay
+ *     CPU time and moves of the block during a pause ('p')
+ *     CPU time of the game, from wait4()
+ * The benchmark fails on a dropped tap, on a burst off by more than one
+ * move, and on a paused game that moves the block or uses more than
+ * PAUSE_CPU of a core.
+ * No real terminal is needed. The board is 20x36 on a 24x80 terminal and the
+ * block is drawn with '#' (-c 35); a game ends before the first block lands.
+ * The game is started with the DAS, ARR and key delay below (-D, -A, -K), so
+ * the burst check holds whatever the defaults of tetris.cpp become.
+ *
+ * support options:
+ *     'g' - games, e.g. '-g 3'
+ *     'n' - taps per game, e.g. '-n 20'
+ *     'i' - ms between taps, e.g. '-i 120'
+ *     'H' - ms an autorepeat burst is held, e.g. '-H 1000'
+ *     'd' - ms before the first repeat of a burst, e.g. '-d 500'
+ *     'r' - ms between the repeats of a burst, e.g. '-r 30'
+ *     'l' - level of the games, 1 to 3
+ *     'p' - ms of the pause, e.g. '-p 2000', 0 skips it
+ *
+ * Usage:
+ * Linux:   g++ -std=c++20 -O2 bench/latency.cpp -o bench/latency -lutil
+ *          bench/latency [options] [path of tetris, default ./tetris]
+ *          or 'make latency'
+ */
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pty.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* the same rules as in tetris.cpp */
+#define KEY_RELEASE_MS 150
+#define DAS_MS 170
+#define ARR_MS 50
+#define KEY_DELAY_MS 660
+const int delay_list[6] = {0, 1600, 1100, 700, 400, 250};
+
+#define ROWS 24
+#define COLS 80
+#define BOARD_W 36
+#define TAP_TIMEOUT_MS 500
+#define PAUSE_CPU 0.05
+
+/* the keys of the taps; ncurses puts the terminal in keypad mode, the arrows send ESC O */
+const char *tap_keys[4] = {"a", "d", "\x1bOD", "\x1bOC"};
+
+static long long get_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+////////////////////////////////////////////////////////
+/*
+ * Just enough of a VT100 to follow what ncurses draws: cursor moves,
+ * erases, scroll regions and the line and character edits.
+ */
+class Screen
+{
+public:
+    Screen(int rows, int cols);
+    void feed(const char *data, int len);
+    bool find_block(int &top, int &left, int &right);
+
+private:
+    enum {
+        ST_TEXT, ST_ESC, ST_CSI, ST_CHARSET
+    };
+    std::vector<std::string> m_cells;
+    int m_rows, m_cols;
+    int m_row = 0, m_col = 0;
+    int m_top = 0, m_bottom;
+    int m_saved_row = 0, m_saved_col = 0;
+    int m_state = ST_TEXT;
+    char m_last = ' ';
+    std::string m_seq;
+
+    void put(char ch);
+    void line_feed();
+    void scroll(int top, int count); /* count > 0 up, < 0 down */
+    void csi(char final);
+    void clamp();
+};
+
+Screen::Screen(int rows, int cols) : m_cells(rows, std::string(cols, ' ')), m_rows(rows), m_cols(cols) {
+    m_bottom = rows - 1;
+}
+
+void Screen::feed(const char *data, int len) {
+    int i;
+    char ch;
+
+    for (i = 0; i < len; i++) {
+        ch = data[i];
+        switch (m_state) {
+        case ST_TEXT:
+            if (ch == 0x1b) {
+                m_state = ST_ESC;
+            } else if (ch == '\r') {
+                m_col = 0;
+            } else if (ch == '\n') {
+                line_feed();
+            } else if (ch == '\b') {
+                if (m_col > 0) m_col--;
+            } else if (ch == '\t') {
+                m_col = std::min(m_cols - 1, (m_col / 8 + 1) * 8);
+            } else if ((unsigned char)ch >= 0x20) {
+                put(ch);
+            }
+            break;
+        case ST_ESC:
+            m_state = ST_TEXT;
+            switch (ch) {
+            case '[':
+                m_seq.clear();
+                m_state = ST_CSI;
+                break;
+            case '(':
+            case ')':
+                m_state = ST_CHARSET;
+                break;
+            case 'D':
+                line_feed();
+                break;
+            case 'E':
+                m_col = 0;
+                line_feed();
+                break;
+            case 'M':
+                if (m_row == m_top) scroll(m_top, -1);
+                else if (m_row > 0) m_row--;
+                break;
+            case '7':
+                m_saved_row = m_row;
+                m_saved_col = m_col;
+                break;
+            case '8':
+                m_row = m_saved_row;
+                m_col = m_saved_col;
+                break;
+            case 'c':
+                m_cells.assign(m_rows, std::string(m_cols, ' '));
+                m_row = m_col = m_top = 0;
+                m_bottom = m_rows - 1;
+                break;
+            }
+            break;
+        case ST_CSI:
+            if (ch >= 0x40 && ch <= 0x7e) {
+                csi(ch);
+                m_state = ST_TEXT;
+            } else {
+                m_seq += ch;
+            }
+            break;
+        case ST_CHARSET:
+            m_state = ST_TEXT;
+            break;
+        }
+    }
+}
+
+/* a write to the last column wraps with the next character */
+void Screen::put(char ch) {
+    if (m_col >= m_cols) {
+        m_col = 0;
+        line_feed();
+    }
+    m_cells[m_row][m_col++] = ch;
+    m_last = ch;
+}
+
+void Screen::line_feed() {
+    if (m_row == m_bottom) scroll(m_top, 1);
+    else if (m_row < m_rows - 1) m_row++;
+}
+
+void Screen::scroll(int top, int count) {
+    int n;
+    for (n = 0; n < abs(count); n++) {
+        if (count > 0) {
+            m_cells.erase(m_cells.begin() + top);
+            m_cells.insert(m_cells.begin() + m_bottom, std::string(m_cols, ' '));
+        } else {
+            m_cells.erase(m_cells.begin() + m_bottom);
+            m_cells.insert(m_cells.begin() + top, std::string(m_cols, ' '));
+        }
+    }
+}
+
+void Screen::clamp() {
+    m_row = std::max(0, std::min(m_row, m_rows - 1));
+    m_col = std::max(0, std::min(m_col, m_cols - 1));
+}
+
+void Screen::csi(char final) {
+    std::vector<int> args;
+    const char *p = m_seq.c_str();
+    int n, row;
+
+    if (*p == '?' || *p == '>' || *p == '=') p++;
+    while (*p) {
+        args.push_back(atoi(p));
+        while (*p && *p != ';') p++;
+        if (*p == ';') p++;
+    }
+    n = args.empty() || args[0] == 0 ? 1 : args[0];
+    std::string &line = m_cells[std::min(m_row, m_rows - 1)];
+
+    switch (final) {
+    case 'H':
+    case 'f':
+        m_row = n - 1;
+        m_col = (args.size() > 1 && args[1] > 0 ? args[1] : 1) - 1;
+        break;
+    case 'A':
+        m_row -= n;
+        break;
+    case 'B':
+        m_row += n;
+        break;
+    case 'C':
+        m_col += n;
+        break;
+    case 'D':
+        m_col = std::min(m_col, m_cols - 1) - n;
+        break;
+    case 'G':
+    case '`':
+        m_col = n - 1;
+        break;
+    case 'd':
+        m_row = n - 1;
+        break;
+    case 'K':
+        n = args.empty() ? 0 : args[0];
+        if (m_col >= m_cols) break;
+        if (n == 0) line.replace(m_col, m_cols - m_col, m_cols - m_col, ' ');
+        else if (n == 1) line.replace(0, m_col + 1, m_col + 1, ' ');
+        else line.assign(m_cols, ' ');
+        break;
+    case 'J':
+        n = args.empty() ? 0 : args[0];
+        for (row = 0; row < m_rows; row++) {
+            if ((n == 0 && row > m_row) || (n == 1 && row < m_row) || n == 2) {
+                m_cells[row].assign(m_cols, ' ');
+            }
+        }
+        if (n == 0 && m_col < m_cols) line.replace(m_col, m_cols - m_col, m_cols - m_col, ' ');
+        if (n == 1) line.replace(0, std::min(m_col + 1, m_cols), std::min(m_col + 1, m_cols), ' ');
+        break;
+    case 'X':
+        if (m_col < m_cols) line.replace(m_col, std::min(n, m_cols - m_col), std::min(n, m_cols - m_col), ' ');
+        break;
+    case '@':
+        if (m_col < m_cols) {
+            line.insert(m_col, std::min(n, m_cols - m_col), ' ');
+            line.resize(m_cols);
+        }
+        break;
+    case 'P':
+        if (m_col < m_cols) {
+            line.erase(m_col, std::min(n, m_cols - m_col));
+            line.resize(m_cols, ' ');
+        }
+        break;
+    case 'L':
+    case 'M':
+        if (m_row >= m_top && m_row <= m_bottom) {
+            std::swap(m_top, m_row);
+            scroll(m_top, final == 'L' ? -std::min(n, m_bottom - m_top + 1) : std::min(n, m_bottom - m_top + 1));
+            std::swap(m_top, m_row);
+        }
+        break;
+    case 'S':
+        scroll(m_top, n);
+        break;
+    case 'T':
+        scroll(m_top, -n);
+        break;
+    case 'r':
+        m_top = (args.size() > 0 && args[0] > 0 ? args[0] : 1) - 1;
+        m_bottom = (args.size() > 1 && args[1] > 0 ? args[1] : m_rows) - 1;
+        if (m_top >= m_bottom || m_bottom >= m_rows) {
+            m_top = 0;
+            m_bottom = m_rows - 1;
+        }
+        m_row = m_col = 0;
+        break;
+    case 'b':
+        while (n-- > 0) put(m_last);
+        break;
+    default: /* attributes, modes and reports do not move anything */
+        break;
+    }
+    clamp();
+}
+
+/*
+ * The falling block is the only '#' on an empty board: return its top row
+ * and its left and right board column, false if there is none or more.
+ */
+bool Screen::find_block(int &top, int &left, int &right) {
+    int row, col, bottom = -1;
+
+    top = left = right = -1;
+    for (row = 0; row < m_rows; row++) {
+        for (col = 0; col < m_cols; col++) {
+            if (m_cells[row][col] != '#') continue;
+            if (top < 0) top = row;
+            bottom = row;
+            if (left < 0 || col / 2 < left) left = col / 2;
+            right = std::max(right, col / 2);
+        }
+    }
+    return top >= 0 && bottom - top < 4 && right - left < 4;
+}
+
+////////////////////////////////////////////////////////
+struct Result {
+    std::vector<double> latency;     /* ms */
+    std::vector<double> jitter;      /* ms off the level delay */
+    int taps = 0, dropped = 0;
+    int bursts = 0, burst_moves = 0, burst_expected = 0, burst_off = 0;
+    double cpu_ms = 0, wall_ms = 0;
+    double pause_ms = 0, pause_cpu_ms = 0;
+    int pause_moves = 0;
+
+    void add(const Result &other);
+    void report(const char *name);
+};
+
+class Game
+{
+public:
+    Game(const char *binary, int level);
+    ~Game();
+    bool is_running() {return m_fd >= 0;}
+    void key(const char *keys);
+    bool pump(long long until_us, bool (Game::*done)() = NULL);
+    bool moved() {return m_left != m_tap_left;}
+    bool started() {return m_left >= 0;}
+    void tap(const char *keys);
+    void burst(char ch, int hold_ms, int delay_ms, int repeat_ms);
+    void pause(int pause_ms);
+    void quit();
+
+    Result result;
+
+private:
+    pid_t m_pid = -1;
+    int m_fd = -1;
+    int m_delay;
+    Screen m_screen;
+    long long m_start;
+    int m_top = -1, m_left = -1, m_right = -1;
+    long long m_step_us = 0;  /* when the block last went down a row */
+    int m_tap_left = -1;
+    long long m_moved_us = 0; /* when the block last moved sideways */
+    bool m_quit = false;
+    int m_moves = 0;          /* steps and shifts of the block seen so far */
+
+    void track(long long now);
+    double cpu_ms();
+};
+
+Game::Game(const char *binary, int level) : m_screen(ROWS, COLS) {
+    struct winsize ws = {ROWS, COLS, 0, 0};
+    char level_arg[8], das_arg[8], arr_arg[8], delay_arg[8];
+
+    m_delay = delay_list[level];
+    m_start = get_us();
+    snprintf(level_arg, sizeof(level_arg), "%d", level);
+    snprintf(das_arg, sizeof(das_arg), "%d", DAS_MS);
+    snprintf(arr_arg, sizeof(arr_arg), "%d", ARR_MS);
+    snprintf(delay_arg, sizeof(delay_arg), "%d", KEY_DELAY_MS);
+    m_pid = forkpty(&m_fd, NULL, NULL, &ws);
+    if (m_pid == 0) {
+        setenv("TERM", "vt100", 1);
+        execl(binary, binary, "-s", "20x36", "-l", level_arg, "-c", "35", "-r", "1",
+              "-D", das_arg, "-A", arr_arg, "-K", delay_arg, (char *)NULL);
+        perror(binary);
+        _exit(127);
+    }
+    if (m_pid < 0) {
+        perror("forkpty");
+        m_fd = -1;
+    }
+}
+
+Game::~Game() {
+    if (m_pid > 0) {
+        kill(m_pid, SIGKILL);
+        waitpid(m_pid, NULL, 0);
+    }
+    if (m_fd >= 0) close(m_fd);
+}
+
+/* one key, the bytes of an escape sequence are written at once */
+void Game::key(const char *keys) {
+    int len = strlen(keys);
+    if (m_fd >= 0 && write(m_fd, keys, len) != len) perror("write");
+}
+
+/* read the screen until until_us, or until done returns true; false at the end of the game */
+bool Game::pump(long long until_us, bool (Game::*done)()) {
+    struct pollfd fd = {m_fd, POLLIN, 0};
+    char data[4096];
+    long long now;
+    int len;
+
+    while (m_fd >= 0) {
+        if (done && (this->*done)()) return true;
+        now = get_us();
+        if (now >= until_us) return true;
+        if (poll(&fd, 1, (until_us - now + 999) / 1000) <= 0) continue;
+        len = read(m_fd, data, sizeof(data));
+        if (len <= 0) {
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        now = get_us();
+        m_screen.feed(data, len);
+        track(now);
+    }
+    return false;
+}
+
+void Game::track(long long now) {
+    int top, left, right;
+
+    if (m_quit) return;
+    /* a read can end in the middle of a redraw */
+    if (!m_screen.find_block(top, left, right)) return;
+    if (m_left >= 0 && top == m_top + 1) {
+        if (m_step_us) result.jitter.push_back((now - m_step_us) / 1000.0 - m_delay);
+        m_step_us = now;
+    }
+    if (m_left >= 0 && left != m_left) m_moved_us = now;
+    if (m_left >= 0 && (top != m_top || left != m_left)) m_moves++;
+    m_top = top;
+    m_left = left;
+    m_right = right;
+}
+
+/* one press, the block should move one column */
+void Game::tap(const char *keys) {
+    long long start = get_us();
+
+    m_tap_left = m_left;
+    key(keys);
+    result.taps++;
+    pump(start + TAP_TIMEOUT_MS * 1000, &Game::moved);
+    if (moved()) {
+        result.latency.push_back((m_moved_us - start) / 1000.0);
+    } else {
+        result.dropped++;
+    }
+}
+
+/*
+ * A key held for hold_ms, as a terminal sends it: the press, the first
+ * repeat after delay_ms, then a repeat every repeat_ms. The press shifts
+ * once; a first repeat after DAS_MS shifts once more and the engine goes on
+ * every ARR_MS from there, otherwise the engine starts at the press plus
+ * DAS_MS; either until KEY_RELEASE_MS after the last key. The wall may stop
+ * it earlier.
+ */
+void Game::burst(char ch, int hold_ms, int delay_ms, int repeat_ms) {
+    long long start = get_us(), now = start, last = start, first = -1, tick;
+    int left = m_left, expected = 1, room = ch == 'a' ? m_left - 1 : BOARD_W - 2 - m_right;
+    char keys[2] = {ch, 0};
+
+    key(keys);
+    pump(start + delay_ms * 1000LL);
+    now = get_us();
+    while (now < start + hold_ms * 1000LL && is_running()) {
+        key(keys);
+        last = now;
+        if (first < 0) first = now;
+        pump(now + repeat_ms * 1000LL);
+        now = get_us();
+    }
+    if (first >= 0) {
+        tick = first - start >= DAS_MS * 1000LL ? first : start + DAS_MS * 1000LL;
+        if (last + KEY_RELEASE_MS * 1000LL >= tick) {
+            expected += (last + KEY_RELEASE_MS * 1000LL - tick) / (ARR_MS * 1000LL) + 1;
+        }
+    }
+    pump(get_us() + (KEY_RELEASE_MS + 2 * ARR_MS) * 1000LL);
+    expected = std::min(expected, room);
+    result.bursts++;
+    result.burst_moves += abs(m_left - left);
+    result.burst_expected += expected;
+    /* the last shift may fall on either side of the release */
+    if (abs(abs(m_left - left) - expected) > 1) result.burst_off++;
+}
+
+/* CPU time of the running game so far, from /proc */
+double Game::cpu_ms() {
+    char path[64], stat[1024], *p;
+    unsigned long utime, stime;
+    FILE *fp;
+    size_t len;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)m_pid);
+    if (m_pid <= 0 || !(fp = fopen(path, "r"))) return 0;
+    len = fread(stat, 1, sizeof(stat) - 1, fp);
+    fclose(fp);
+    stat[len] = 0;
+    /* the name in parentheses may hold spaces, utime and stime are the 12th and 13th field after it */
+    if (!(p = strrchr(stat, ')')) || sscanf(p + 1, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %lu %lu",
+                                             &utime, &stime) != 2) {
+        return 0;
+    }
+    return (utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+}
+
+/* a paused game should neither move the block nor use the CPU until it goes on */
+void Game::pause(int pause_ms) {
+    long long start;
+    double cpu;
+    int moves;
+
+    key("p");
+    pump(get_us() + 100000LL);
+    start = get_us();
+    cpu = cpu_ms();
+    moves = m_moves;
+    pump(start + pause_ms * 1000LL);
+    result.pause_ms += (get_us() - start) / 1000.0;
+    result.pause_cpu_ms += cpu_ms() - cpu;
+    result.pause_moves += m_moves - moves;
+    key("p");
+    /* the first step after the pause is no gravity step */
+    m_step_us = 0;
+}
+
+void Game::quit() {
+    struct rusage usage;
+    int status;
+
+    key("q");
+    m_quit = true;
+    pump(get_us() + 3000000LL);
+    if (m_pid > 0 && wait4(m_pid, &status, 0, &usage) == m_pid) {
+        result.cpu_ms = usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0 +
+                 usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+        m_pid = -1;
+    }
+    result.wall_ms = (get_us() - m_start) / 1000.0;
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+void Result::add(const Result &other) {
+    latency.insert(latency.end(), other.latency.begin(), other.latency.end());
+    jitter.insert(jitter.end(), other.jitter.begin(), other.jitter.end());
+    taps += other.taps;
+    dropped += other.dropped;
+    bursts += other.bursts;
+    burst_off += other.burst_off;
+    burst_moves += other.burst_moves;
+    burst_expected += other.burst_expected;
+    cpu_ms += other.cpu_ms;
+    wall_ms += other.wall_ms;
+    pause_ms += other.pause_ms;
+    pause_cpu_ms += other.pause_cpu_ms;
+    pause_moves += other.pause_moves;
+}
+
+void Result::report(const char *name) {
+    double sum = 0, worst = 0;
+    size_t i;
+
+    for (i = 0; i < jitter.size(); i++) {
+        sum += fabs(jitter[i]);
+        worst = std::max(worst, fabs(jitter[i]));
+    }
+    printf("%s: taps %d, dropped %d, latency p50 %.1f p95 %.1f max %.1f ms\n", name, taps, dropped,
+           percentile(latency, 0.5), percentile(latency, 0.95), percentile(latency, 1.0));
+    printf("%*s  bursts %d of %d moves, gravity %zu steps, jitter mean %.1f max %.1f ms\n",
+           (int)strlen(name), "", burst_moves, burst_expected, jitter.size(),
+           jitter.empty() ? 0 : sum / jitter.size(), worst);
+    printf("%*s  cpu %.0f ms in %.1f s (%.2f%%)\n", (int)strlen(name), "", cpu_ms, wall_ms / 1000,
+           wall_ms > 0 ? 100 * cpu_ms / wall_ms : 0);
+    if (pause_ms > 0) {
+        printf("%*s  paused %.1f s, cpu %.0f ms (%.2f%%), %d moves\n", (int)strlen(name), "",
+               pause_ms / 1000, pause_cpu_ms, 100 * pause_cpu_ms / pause_ms, pause_moves);
+    }
+}
+
+////////////////////////////////////////////////////////
+int main(int argc, char *argv[]) {
+    int games = 3, taps = 20, interval = 120, hold = 1000, delay = 500, repeat = 30, level = 1, pause = 2000;
+    int help = 0, status = 0;
+    const char *binary = "./tetris";
+    int i, j;
+    char c;
+
+    while ((c = getopt(argc, argv, "hg:n:i:H:d:r:l:p:")) != -1) {
+        switch (c) {
+        case 'g':
+            games = atoi(optarg);
+            if (games < 1) help = 1;
+            break;
+        case 'n':
+            taps = atoi(optarg);
+            if (taps < 0) help = 1;
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            if (interval < 1) help = 1;
+            break;
+        case 'H':
+            hold = atoi(optarg);
+            if (hold < 0) help = 1;
+            break;
+        case 'd':
+            delay = atoi(optarg);
+            if (delay <= KEY_RELEASE_MS || delay > KEY_DELAY_MS) help = 1;
+            break;
+        case 'r':
+            repeat = atoi(optarg);
+            if (repeat < 1 || repeat >= KEY_RELEASE_MS) help = 1;
+            break;
+        case 'l':
+            level = atoi(optarg);
+            if (level < 1 || level > 3) help = 1;
+            break;
+        case 'p':
+            pause = atoi(optarg);
+            if (pause < 0) help = 1;
+            break;
+        case 'h':
+        default:
+            help = 1;
+        }
+    }
+    if (optind < argc) binary = argv[optind];
+
+    if (help) {
+        std::cout << argv[0] << " [-g games] [-n taps] [-i interval] [-H hold] [-d delay] [-r repeat]\n"
+                                "      [-l level] [-p pause] [tetris]\n"
+                                "  games: \tgames to play, default 3\n"
+                                "  taps:  \tsingle key presses per game, default 20\n"
+                                "  interval:\tms between taps, default 120\n"
+                                "  hold:  \tms of each autorepeat burst, default 1000\n"
+                                "  delay: \tms before the first repeat of a burst, (150, 660], default 500\n"
+                                "  repeat:\tms between the repeats of a burst, default 30\n"
+                                "  level: \t[1, 3], default 1\n"
+                                "  pause: \tms of the pause, 0 none, default 2000\n";
+        exit(0);
+    }
+
+    Result total;
+    for (i = 1; i <= games; i++) {
+        Game game(binary, level);
+        char name[16];
+
+        if (!game.pump(get_us() + 2000000LL, &Game::started) || !game.started()) {
+            fprintf(stderr, "%s: no block on the screen\n", binary);
+            exit(1);
+        }
+        for (j = 0; j < taps && game.is_running(); j++) {
+            long long next = get_us() + interval * 1000LL;
+            game.tap(tap_keys[j % 4]);
+            game.pump(next);
+        }
+        game.burst('a', hold, delay, repeat);
+        game.burst('d', hold, delay, repeat);
+        if (pause > 0) game.pause(pause);
+        /* two steps of gravity without any key */
+        game.pump(get_us() + 2 * delay_list[level] * 1000LL + 200000LL);
+        game.quit();
+
+        snprintf(name, sizeof(name), "game %d", i);
+        game.result.report(name);
+        total.add(game.result);
+    }
+    total.report("all");
+    if (total.dropped > 0) {
+        fprintf(stderr, "%s: %d taps did not move the block\n", binary, total.dropped);
+        status = 1;
+    }
+    if (total.burst_off > 0) {
+        fprintf(stderr, "%s: %d of %d bursts off by more than a move\n", binary, total.burst_off, total.bursts);
+        status = 1;
+    }
+    if (total.pause_moves > 0 || total.pause_cpu_ms > PAUSE_CPU * total.pause_ms) {
+        fprintf(stderr, "%s: the paused game did not sleep\n", binary);
+        status = 1;
+    }
+    return status;
+}
@@ -3,22 +3,66 @@
  * Time: 20240505 19:33:30
  * support shortcut keys: 
  *     'p' - PAUSE
+ *     'u' - UNDO the last locked block
  *     't' - Tips for next
  *     '1,,5' - LEVEL
  * support options:
  *     's' - HxW, e.g. '-s 20x15'
  *     'l' - LEVEL
  *     't' - Tips
+ *     'r' - random seed, e.g. '-r 42'
+ *     'b' - bot pipe mode, see "Bot protocol" below
+ *     'D' - delayed auto shift in ms, e.g. '-D 170'
+ *     'A' - auto repeat rate in ms, e.g. '-A 50', 0 shifts to the wall
+ *     'K' - longest delay of the terminal before a held key repeats, e.g. '-K 660'
+ *     'w' - autoplayer weights, e.g. '-w -0.36,-0.51,-0.18,-0.10,0.76'
+ *     'T' - tune the autoplayer weights by self-play, e.g. '-T tune.txt'
+ *     'g' - generations to tune, e.g. '-g 20'
+ *     'm' - dashboard of autoplayer games, e.g. '-m 8'; with '-T' it shows the
+ *           games of the tuning run, else games of the '-w' weights paced
+ *           by the level
+ *     'f' - dashboard refreshes per second, e.g. '-f 10'
+ *     'R' - replay a recorded workload headless, e.g. '-R train/selfplay.txt'
+ *     'L' - append telemetry of every block and game to a log, e.g. '-L games.tlm'
+ *     'S' - print a summary of a telemetry log, e.g. '-S games.tlm'
  * 
  * Usage:
- * Windows: x86_64-w64-mingw32-g++.exe -g tetris.cpp -o tetris.exe
+ * Windows: x86_64-w64-mingw32-g++.exe -std=c++20 -g tetris.cpp -o tetris.exe
  *          tetris.exe
- * Linux:   g++ -g tetris.cpp -o tetris -lncurses
+ * Linux:   g++ -std=c++20 -g tetris.cpp -o tetris -lncurses -pthread
  *          tetris
+ *          or 'make release', 'make lto', 'make pgo', see Makefile
+ *
+ * Bot protocol ('-b'):
+ *     No curses, no screen refresh and no pacing; the game runs as fast as
+ *     the bot answers. For each turn one state line is written to stdout:
+ *         S <score> <type> <rota> <y> <x> <next_type> <next_rota> <H> <W> <top> <cells>
+ *     <cells> is (H-top)*W digits of the rows <top> to H-1, row by row:
+ *     0 free, 1 filled, 4 border. The rows above <top> are free between
+ *     their two border cells, so the line grows with the stack, not with
+ *     the board.
+ *     The bot replies with one line on stdin:
+ *         P <rota> <x>   rotate to <rota>, shift to column <x>, drop and lock
+ *         A <keys>       batch of keys: 'w' rotate, 'a' left, 'd' right,
+ *                        's' down (locks when landed), 'x' drop and lock
+ *         U <n>          undo the last <n> locked blocks
+ *         Q              quit
+ *     When a lock ends the game "O <score>" is written instead of a state
+ *     line; the bot may still take blocks back with 'U', or end with 'Q'.
+ *     The process exits on 'Q' or at the end of stdin.
  */
 #include <iostream>
 #include <cstring>
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <coroutine>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <math.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,43 +82,118 @@
 static void init_curses() {}
 static void exit_curses() {}
 static int timeout(int t) {return t;}
+static void get_view_size(int &rows, int &cols) {
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    rows = cols = 0;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+        rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+        cols = info.srWindow.Right - info.srWindow.Left + 1;
+    }
+}
+/* no mmap, the file is read */
+static const void *map_file(const char *file, size_t &size) {
+    FILE *fp = fopen(file, "rb");
+    char *data;
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = (char *)malloc(size + 1);
+    if (fread(data, 1, size, fp) != size) size = 0;
+    fclose(fp);
+    return data;
+}
+static void unmap_file(const void *data, size_t) {free((void *)data);}
 #else //linux
 #include <time.h>
 #include <sys/time.h>
 #include <ncurses.h> /* getch */
 #include <unistd.h> /* usleep */
-
-#define CHR_RIGHT 5
-#define CHR_LEFT  4
-#define CHR_DOWN  2
-#define CHR_UP    3
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHR_RIGHT KEY_RIGHT /* keypad() decodes the arrow keys */
+#define CHR_LEFT  KEY_LEFT
+#define CHR_DOWN  KEY_DOWN
+#define CHR_UP    KEY_UP
 #define mingw_gettimeofday  gettimeofday
 #define Sleep(x)            usleep(x * 1000)
 #define output(txt, args...) printw(txt, ##args)
 typedef unsigned char       uint8_t;
 typedef unsigned int        uint32_t;
 
-static int kbhit() {return 1;}
 static void init_curses() {
     initscr();
-    timeout(1);
+    timeout(0);
     noecho();
     keypad(stdscr, 1);
 }
 static void exit_curses() {
 	endwin();
 }
+static void get_view_size(int &rows, int &cols) {
+    rows = LINES;
+    cols = COLS;
+}
+static const void *map_file(const char *file, size_t &size) {
+    struct stat st;
+    void *data;
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    size = st.st_size;
+    data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : (void *)"";
+    close(fd);
+    return data == MAP_FAILED ? NULL : data;
+}
+static void unmap_file(const void *data, size_t size) {
+    if (size) munmap((void *)data, size);
+}
 #endif
 
 static bool _tips = false;
 static int _dbg = 0;
+static int _das_ms = 170; /* delayed auto shift */
+static int _arr_ms = 50;  /* auto repeat rate */
+static int _key_delay_ms = 660; /* longest delay of the terminal before a held key repeats */
 #define debug(txt, args...)  if (_dbg) output("%s[%d]: " txt "\n", __FUNCTION__, __LINE__, ##args)
 
+/* no repeat of a held key within this window means it was released */
+#define KEY_RELEASE_MS 150
+
+static long long get_ms() {
+    struct timeval now;
+    mingw_gettimeofday(&now, NULL);
+    return now.tv_sec * 1000LL + now.tv_usec / 1000;
+}
+
+static long long get_us() {
+    struct timeval now;
+    mingw_gettimeofday(&now, NULL);
+    return now.tv_sec * 1000000LL + now.tv_usec;
+}
+
+/* return -1 if no key is pending */
+static int read_key() {
+#ifdef _WIN32
+    return kbhit() ? getch() : -1;
+#else
+    int key = getch();
+    return key == ERR ? -1 : key;
+#endif
+}
+
 #define KIND_NUM   7
 #define DIRECT_NUM 4
+#define UNDO_NUM   1024 /* locked blocks that can be undone */
 
-static uint8_t HEIGHT = 20;
-static uint8_t WIDTH = 15;
+static int HEIGHT = 20;
+static int WIDTH = 15;
 
 const int delay_list[6] = {0, 1600, 1100, 700, 400, 250};
 static int level2delay(int level) {
@@ -90,13 +209,26 @@ enum {
     MOVE_NONE,
     MOVE_ROTATE, MOVE_LEFT, MOVE_RIGHT, MOVE_DOWN,
     MOVE_QUIT, MOVE_PAUSE, MOVE_HINT,
-    MOVE_L1, MOVE_L2, MOVE_L3, MOVE_L4, MOVE_L5
+    MOVE_L1, MOVE_L2, MOVE_L3, MOVE_L4, MOVE_L5,
+    MOVE_UNDO
 };
 
 enum {
     STAT_NORMAL, STAT_COLLIDE, STAT_STOP
 };
 
+/* board features rated by the autoplayer, see Board::get_features() */
+enum {
+    FEAT_HOLES, FEAT_HEIGHTS, FEAT_BUMPINESS, FEAT_WELLS, FEAT_LINES, FEAT_NUM
+};
+static double _weights[FEAT_NUM] = {-0.36, -0.51, -0.18, -0.10, 0.76};
+static const char *_tune_file = NULL;
+static int _dash_games = 0;
+static int _dash_fps = 10;
+static const char *_replay_file = NULL;
+static const char *_log_file = NULL;
+static int _tune_generations = 20;
+
 // Block definition
 char defBlocks [KIND_NUM][DIRECT_NUM][4][4] =
 {
@@ -294,51 +426,194 @@ char defBlocks [KIND_NUM][DIRECT_NUM][4][4] =
 };
 
 ////////////////////////////////////////////////////////
+/*
+ * Matrix<H, W> has its size fixed at compile time, so every loop over it has
+ * constant bounds; Matrix<0, 0> below takes the size at runtime.
+ * Every row starts as a copy of the blank row given by setBlankRow().
+ * Rows and columns are not checked, callers stay inside the matrix.
+ */
+template <int H = 0, int W = 0>
 class Matrix {
 private:
-    std::vector< std::vector<char> > data;
-    char ** data_ptr = NULL;
- 
+    char data[H][W];
+    char blank[W];
+    int count[H]; /* non-free cells of each row */
+    int blank_count;
+
 public:
-    Matrix(size_t rows, size_t cols) : data(rows, std::vector<char>(cols, 0)) {}
- 
+    Matrix(size_t = H, size_t = W) {
+        memset(blank, 0, sizeof(blank));
+        blank_count = 0;
+        reset();
+    }
+
     size_t getRows() const {
-        return data.size();
+        return H;
     }
 
     size_t getCols() const {
-        return data[0].size();
+        return W;
     }
 
     void setValue(size_t row, size_t col, char value) {
-        if (row < data.size() && col < data[row].size()) {
-            data[row][col] = value;
-        }
+        count[row] += (value != 0) - (data[row][col] != 0);
+        data[row][col] = value;
     }
- 
+
     char getValue(size_t row, size_t col) const {
-        if (row < data.size() && col < data[row].size()) {
-            return data[row][col];
+        return data[row][col];
+    }
+
+    const char *getRow(size_t row) const {
+        return data[row];
+    }
+
+    int countRow(size_t row) const {
+        return count[row];
+    }
+
+    void setBlankRow(const char *cells) {
+        int col;
+        memcpy(blank, cells, W);
+        for (blank_count = 0, col = 0; col < W; col++) blank_count += (blank[col] != 0);
+        reset();
+    }
+
+    void reset() {
+        for (int row = 0; row < H; row++) {
+            memcpy(data[row], blank, W);
+            count[row] = blank_count;
+        }
+    }
+
+    /* remove row index, rows above it move one row down, row 0 becomes blank */
+    void shiftDown(size_t index) {
+        memmove(data[1], data[0], index * W);
+        memmove(&count[1], &count[0], index * sizeof(count[0]));
+        memcpy(data[0], blank, W);
+        count[0] = blank_count;
+    }
+
+    /* undo shiftDown(): row 0 is dropped, rows above index move one row up */
+    void insertRow(size_t index, const char *cells) {
+        int col;
+        memmove(data[0], data[1], index * W);
+        memmove(&count[0], &count[1], index * sizeof(count[0]));
+        memcpy(data[index], cells, W);
+        for (count[index] = 0, col = 0; col < W; col++) count[index] += (cells[col] != 0);
+    }
+};
+
+/*
+ * Sparse storage for boards of any size: rows that still equal the blank row
+ * all share it, a row gets its own cells on the first write. Memory scales
+ * with the rows in use, not with the board area.
+ */
+template <>
+class Matrix<0, 0> {
+private:
+    std::vector<char *> rowp;
+    std::vector<int> count; /* non-free cells of each row */
+    std::vector<char *> pool; /* unused rows for reuse */
+    std::vector<char> blank;
+    int blank_count;
+    size_t cols;
+
+    bool isBlank(size_t row) const {
+        return rowp[row] == blank.data();
+    }
+
+    char *ownRow(size_t row) {
+        if (!isBlank(row)) return rowp[row];
+        char *cells;
+        if (pool.empty()) {
+            cells = new char[cols];
+        } else {
+            cells = pool.back();
+            pool.pop_back();
         }
-        return 0; //throw exception
+        memcpy(cells, blank.data(), cols);
+        rowp[row] = cells;
+        return cells;
+    }
+
+    void dropRow(size_t row) {
+        if (!isBlank(row)) pool.push_back(rowp[row]);
+        rowp[row] = blank.data();
+        count[row] = blank_count;
+    }
+
+public:
+    Matrix(size_t rows, size_t cols) : count(rows, 0), blank(cols, 0), blank_count(0), cols(cols) {
+        rowp.assign(rows, blank.data());
+    }
+
+    Matrix(const Matrix &) = delete;
+    Matrix &operator=(const Matrix &) = delete;
+
+    ~Matrix() {
+        size_t row;
+        for (row = 0; row < rowp.size(); row++) dropRow(row);
+        for (row = 0; row < pool.size(); row++) delete[] pool[row];
+    }
+
+    size_t getRows() const {
+        return rowp.size();
+    }
+
+    size_t getCols() const {
+        return cols;
+    }
+
+    void setValue(size_t row, size_t col, char value) {
+        if (rowp[row][col] == value) return;
+        char *cells = ownRow(row);
+        count[row] += (value != 0) - (cells[col] != 0);
+        cells[col] = value;
+    }
+
+    char getValue(size_t row, size_t col) const {
+        return rowp[row][col];
+    }
+
+    const char *getRow(size_t row) const {
+        return rowp[row];
+    }
+
+    int countRow(size_t row) const {
+        return count[row];
+    }
+
+    void setBlankRow(const char *cells) {
+        size_t col;
+        memcpy(blank.data(), cells, cols);
+        for (blank_count = 0, col = 0; col < cols; col++) blank_count += (blank[col] != 0);
+        reset();
     }
 
     void reset() {
-        std::fill(data[0].begin(), data[0].end(), 0);        
-        std::fill(data.begin(), data.end(), data[0]);        
+        size_t row;
+        for (row = 0; row < rowp.size(); row++) dropRow(row);
     }
- 
-    char ** allocArray() {
-        if (data_ptr) return data_ptr;
-        data_ptr = (char **)malloc(data.size() * sizeof(char *));
-        int i;
-        for (i=0; i<data.size(); i++) data_ptr[i] = data[i].data();
-        return data_ptr;
+
+    /* remove row index, rows above it move one row down, row 0 becomes blank */
+    void shiftDown(size_t index) {
+        if (!isBlank(index)) pool.push_back(rowp[index]);
+        memmove(&rowp[1], &rowp[0], index * sizeof(rowp[0]));
+        memmove(&count[1], &count[0], index * sizeof(count[0]));
+        rowp[0] = blank.data();
+        count[0] = blank_count;
     }
 
-    void freeArray() {
-        free(data_ptr);
-        data_ptr = NULL;
+    /* undo shiftDown(): row 0 is dropped, rows above index move one row up */
+    void insertRow(size_t index, const char *cells) {
+        size_t col;
+        dropRow(0);
+        memmove(&rowp[0], &rowp[1], index * sizeof(rowp[0]));
+        memmove(&count[0], &count[1], index * sizeof(count[0]));
+        rowp[index] = blank.data();
+        memcpy(ownRow(index), cells, cols);
+        for (count[index] = 0, col = 0; col < cols; col++) count[index] += (cells[col] != 0);
     }
 };
 
@@ -347,10 +622,11 @@ class Block
 {
 public:
     Block(int type, int rotation, int pos_y, int pos_x);
-    int put_data_array(char *array[], bool ignore_detail);
+    char cell(int row, int col) const {return data[row][col];}
     void move(int action);
     void backup();
     void restore();
+    void get_info(int &type, int &rotation, int &pos_y, int &pos_x) const;
 
 private:
     int m_type;
@@ -375,26 +651,6 @@ Block::Block(int type, int rotation, int pos_y, int pos_x) {
     debug("type %d, rotation %d, pos_y %d, pos_x %d", type, rotation, pos_y, pos_x);
 }
 
-int Block::put_data_array(char *array[], bool ignore_detail) {
-    int failure = 0;
-    size_t row, col;
-    for (row = 0; row < 4; row++) {
-        for (col = 0; col < 4; col++) {
-            if (!data[row][col]) continue;
-            if ((m_pos_y + row) >= HEIGHT) continue;
-            if ((m_pos_x + col) < 0 || (m_pos_x + col) >= WIDTH) continue;
-
-            char *ptr = &array[m_pos_y + row][m_pos_x + col];
-            *ptr += ignore_detail ? 1 : data[row][col];
-            if (ignore_detail && (*ptr > 1)) {
-                *ptr = 1;
-                failure = 1;
-            }
-        }
-    }
-    return failure;
-}
-
 void Block::move(int action) {
     switch (action) {
         case MOVE_LEFT:
@@ -431,7 +687,285 @@ void Block::restore() {
     b_rotation = b_pos_x = b_pos_y = -1;
 }
 
+void Block::get_info(int &type, int &rotation, int &pos_y, int &pos_x) const {
+    type = m_type;
+    rotation = m_rotation;
+    pos_y = m_pos_y;
+    pos_x = m_pos_x;
+}
+
+////////////////////////////////////////////////////////
+/*
+ * Telemetry log ('-L file'): one row per locked block and one per game,
+ * appended as chunks of TELEMETRY_ROWS rows. A chunk stores its rows column
+ * by column, each value as the zigzag varint of its difference to the row
+ * before, which packs a block into about 10 bytes:
+ *     "TLM1" <kind> <rows> <cols> <bytes of each column> <columns>
+ * all u32 little endian. Games add finished rows from any thread, a
+ * background thread encodes and writes the full chunks. A block row holds
+ * the id and the seed of its game; ids go on from those already in the log,
+ * so the blocks of appended runs join to their own game row.
+ */
+enum {
+    LOG_PIECE, LOG_GAME, LOG_KIND_NUM
+};
+
+/* columns of the rows of each kind */
+enum {
+    PIECE_GAME, PIECE_SEED, PIECE_TYPE, PIECE_ROTA, PIECE_X, PIECE_Y, PIECE_LINES, PIECE_STACK,
+    PIECE_THINK, PIECE_LEVEL, PIECE_COLS
+};
+enum {
+    GAME_ID, GAME_SEED, GAME_PIECES, GAME_SCORE, GAME_LEVEL, GAME_COLS
+};
+static const int log_cols[LOG_KIND_NUM] = {PIECE_COLS, GAME_COLS};
+
+#define TELEMETRY_ROWS 65536
+
+class Telemetry
+{
+public:
+    Telemetry(const char *file);
+    ~Telemetry();
+    bool is_open() {return m_fp != NULL;}
+    unsigned int new_game() {return m_games++;}
+    void add(int kind, const long long *rows, int count);
+    static bool print_stats(const char *file);
+    static unsigned int next_game(const char *file);
+
+private:
+    struct Chunk {
+        int kind;
+        std::vector<long long> values; /* row by row */
+    };
+    FILE *m_fp;
+    std::atomic<unsigned int> m_games;
+    Chunk m_chunk[LOG_KIND_NUM];
+    std::deque<Chunk> m_full;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    bool m_stop;
+    std::thread m_writer;
+
+    void flush();
+    void write_chunk(const Chunk &chunk);
+};
+
+/* game ids go on from those already in the log, so appended runs do not mix */
+Telemetry::Telemetry(const char *file) : m_games(next_game(file)), m_stop(false) {
+    int kind;
+    m_fp = fopen(file, "ab");
+    for (kind = 0; kind < LOG_KIND_NUM; kind++) m_chunk[kind].kind = kind;
+    if (m_fp) m_writer = std::thread(&Telemetry::flush, this);
+}
+
+/* the rows still in memory are written before the file is closed */
+Telemetry::~Telemetry() {
+    int kind;
+    if (!m_fp) return;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (kind = 0; kind < LOG_KIND_NUM; kind++) {
+            if (!m_chunk[kind].values.empty()) m_full.push_back(std::move(m_chunk[kind]));
+        }
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    m_writer.join();
+    fclose(m_fp);
+}
+
+void Telemetry::add(int kind, const long long *rows, int count) {
+    std::lock_guard<std::mutex> guard(m_lock);
+    Chunk &chunk = m_chunk[kind];
+
+    chunk.values.insert(chunk.values.end(), rows, rows + count * log_cols[kind]);
+    if ((int)chunk.values.size() >= TELEMETRY_ROWS * log_cols[kind]) {
+        m_full.push_back(std::move(chunk));
+        chunk.kind = kind;
+        chunk.values.clear();
+        m_cond.notify_one();
+    }
+}
+
+/* writer thread */
+void Telemetry::flush() {
+    std::unique_lock<std::mutex> guard(m_lock);
+
+    while (true) {
+        m_cond.wait(guard, [this] {return m_stop || !m_full.empty();});
+        if (m_full.empty()) break;
+        Chunk chunk = std::move(m_full.front());
+        m_full.pop_front();
+        guard.unlock();
+        write_chunk(chunk);
+        guard.lock();
+    }
+    fflush(m_fp);
+}
+
+void Telemetry::write_chunk(const Chunk &chunk) {
+    int cols = log_cols[chunk.kind], rows = chunk.values.size() / cols, row, col;
+    std::vector<std::vector<uint8_t>> data(cols);
+    std::vector<uint32_t> header;
+    unsigned long long zigzag;
+    long long prev, delta;
+
+    for (col = 0; col < cols; col++) {
+        for (prev = 0, row = 0; row < rows; row++) {
+            delta = chunk.values[row * cols + col] - prev;
+            prev = chunk.values[row * cols + col];
+            zigzag = ((unsigned long long)delta << 1) ^ (unsigned long long)(delta >> 63);
+            for (; zigzag >= 0x80; zigzag >>= 7) data[col].push_back((zigzag & 0x7f) | 0x80);
+            data[col].push_back(zigzag);
+        }
+    }
+    header.push_back(0x314d4c54); /* "TLM1" */
+    header.push_back(chunk.kind);
+    header.push_back(rows);
+    header.push_back(cols);
+    for (col = 0; col < cols; col++) header.push_back(data[col].size());
+    fwrite(header.data(), sizeof(header[0]), header.size(), m_fp);
+    for (col = 0; col < cols; col++) fwrite(data[col].data(), 1, data[col].size(), m_fp);
+}
+
+/* decode one column of a chunk from data up to end, false unless it fills it exactly */
+static bool decode_column(const uint8_t *data, const uint8_t *end, int rows, long long *values, int stride) {
+    unsigned long long zigzag;
+    long long prev = 0;
+    int row, shift;
+
+    for (row = 0; row < rows; row++) {
+        for (zigzag = 0, shift = 0; data < end && (*data & 0x80); data++, shift += 7) {
+            if (shift > 63 - 7) return false;
+            zigzag |= (unsigned long long)(*data & 0x7f) << shift;
+        }
+        if (data == end) return false;
+        zigzag |= (unsigned long long)*data++ << shift;
+        prev += (long long)(zigzag >> 1) ^ -(long long)(zigzag & 1);
+        values[(size_t)row * stride] = prev;
+    }
+    return data == end;
+}
+
+/*
+ * Read the header and the column sizes of the chunk at pos of a mapped log;
+ * return NULL, or "bad" or "truncated" if the chunk does not fit the log.
+ */
+static const char *read_chunk(const uint8_t *base, size_t size, size_t pos, uint32_t *header, uint32_t *sizes) {
+    size_t end;
+    int col;
+
+    if (size - pos < 4 * sizeof(uint32_t)) return "truncated";
+    memcpy(header, base + pos, 4 * sizeof(uint32_t));
+    if (header[0] != 0x314d4c54 || header[1] >= LOG_KIND_NUM || (int)header[3] != log_cols[header[1]]) {
+        return "bad";
+    }
+    end = pos + (4 + header[3]) * sizeof(uint32_t);
+    if (end > size) return "truncated";
+    memcpy(sizes, base + pos + 4 * sizeof(uint32_t), header[3] * sizeof(uint32_t));
+    for (col = 0; col < (int)header[3]; col++) {
+        /* every value takes at least one byte */
+        if (sizes[col] < header[2]) return "bad";
+        end += sizes[col];
+    }
+    return end > size ? "truncated" : NULL;
+}
+
+/* the first game id after those of file, which is read up to a bad chunk */
+unsigned int Telemetry::next_game(const char *file) {
+    size_t size, pos = 0;
+    const uint8_t *base = (const uint8_t *)map_file(file, size);
+    std::vector<long long> ids;
+    uint32_t header[4], sizes[PIECE_COLS];
+    long long next = 0;
+    size_t i;
+    int col;
+
+    if (!base) return 0;
+    /* the game id is the first column of either kind, the others are skipped */
+    while (pos < size && !read_chunk(base, size, pos, header, sizes)) {
+        pos += (4 + header[3]) * sizeof(uint32_t);
+        ids.resize(header[2]);
+        if (!decode_column(base + pos, base + pos + sizes[0], header[2], ids.data(), 1)) break;
+        for (col = 0; col < (int)header[3]; col++) pos += sizes[col];
+        for (i = 0; i < ids.size(); i++) next = std::max(next, ids[i] + 1);
+    }
+    unmap_file(base, size);
+    return next;
+}
+
+/*
+ * '-S file': summary of a telemetry log, read through a memory map. The
+ * column sizes of a chunk bound every read; a bad or truncated chunk ends
+ * the summary with what came before it, and fails.
+ */
+bool Telemetry::print_stats(const char *file) {
+    size_t size, pos = 0, start;
+    const uint8_t *base = (const uint8_t *)map_file(file, size);
+    std::vector<long long> values;
+    long long pieces = 0, games = 0, lines = 0, stack = 0, think = 0, think_max = 0, score_max = 0;
+    long long types[KIND_NUM] = {0}, clears[5] = {0};
+    uint32_t header[4], sizes[PIECE_COLS];
+    const char *error = NULL;
+    int row, col, cols;
+
+    if (!base) {
+        fprintf(stderr, "can not open %s\n", file);
+        return false;
+    }
+    while (pos < size) {
+        if ((error = read_chunk(base, size, pos, header, sizes))) break;
+        cols = header[3];
+        start = pos + sizeof(header) + cols * sizeof(uint32_t);
+        values.resize((size_t)header[2] * cols);
+        for (col = 0; col < cols; start += sizes[col], col++) {
+            if (!decode_column(base + start, base + start + sizes[col], header[2], values.data() + col, cols)) {
+                error = "bad";
+                break;
+            }
+        }
+        if (error) break;
+        pos = start;
+
+        for (row = 0; row < (int)header[2]; row++) {
+            const long long *v = values.data() + row * cols;
+            if (header[1] == LOG_GAME) {
+                games++;
+                score_max = std::max(score_max, v[GAME_SCORE]);
+                continue;
+            }
+            pieces++;
+            lines += v[PIECE_LINES];
+            stack += v[PIECE_STACK];
+            think += v[PIECE_THINK];
+            think_max = std::max(think_max, v[PIECE_THINK]);
+            if (v[PIECE_TYPE] >= 0 && v[PIECE_TYPE] < KIND_NUM) types[v[PIECE_TYPE]]++;
+            if (v[PIECE_LINES] >= 0 && v[PIECE_LINES] <= 4) clears[v[PIECE_LINES]]++;
+        }
+    }
+    unmap_file(base, size);
+    if (error) fprintf(stderr, "%s: %s chunk at %zu\n", file, error, pos);
+
+    printf("%lld games, %lld blocks, %lld lines, best game %lld lines, %zu bytes\n",
+           games, pieces, lines, score_max, size);
+    if (pieces == 0) return !error;
+    printf("stack %.2f rows, think %.1f us (max %lld us) per block\n",
+           (double)stack / pieces, (double)think / pieces, think_max);
+    printf("blocks by type:");
+    for (row = 0; row < KIND_NUM; row++) printf(" %lld", types[row]);
+    printf("\nclears of 1-4 lines: %lld %lld %lld %lld\n", clears[1], clears[2], clears[3], clears[4]);
+    return !error;
+}
+
+static Telemetry *_telemetry = NULL;
+
 ////////////////////////////////////////////////////////
+/*
+ * Board<H, W> is compiled for one board size (see run_game() in main),
+ * Board<0, 0> is the fallback for any size given by '-s HxW'.
+ */
+template <int H = 0, int W = 0>
 class Board
 {
     enum {
@@ -439,20 +973,30 @@ class Board
     };
 
 public:
-    Board(char ch = 0);
+    Board(char ch = 0, unsigned int seed = 1);
     ~Board();
-    void put_data_array(char *array[]);
     void new_block();
     void free_block();
-    int check_block_data(char *array[], bool rotate);
+    int check_block(bool rotate);
     int move_block(int action);
     int clear_line();
+    int lock_block();
+    int undo(int count);
     void clear_screen();
+    void render_line(int row, int left, int count, char *buffer);
     void refresh_screen(bool clear = true);
     void set_game_pause();
     bool is_game_pause();
     void set_game_over();
     bool is_game_over();
+    bool update_game_over();
+    int get_score();
+    bool get_block_info(int &type, int &rotation, int &pos_y, int &pos_x);
+    void put_state(FILE *fp);
+    void get_features(int *feat);
+    bool find_placement(const double *weights, int &rotation, int &pos_x);
+    int height() const {return dataM->getRows();}
+    int width() const {return dataM->getCols();}
 
     int delay_ms; /* milliseconds */
 
@@ -462,16 +1006,77 @@ private:
     bool isPaused;
     bool isGameOver;
     char blkCh;
-    Matrix *dataM = NULL;
+    Matrix<H, W> *dataM = NULL;
     int next_blk_type;
     int next_blk_rota;
+    int lock_y; /* top row of the last locked block */
+    int spawn_rota; /* rotation of the block when it was spawned */
+    unsigned int rng_state; /* every board has its own random sequence */
+
+    /* what one locked block changed, see lock_block() */
+    struct LockDelta {
+        unsigned short cells[4][2]; /* row, col filled by free_block */
+        unsigned short lines[4];    /* rows removed by clear_line, in order */
+        char cell_num;
+        char line_num;
+        char type;
+        char rotation;
+        char next_type;
+        char next_rota;
+        unsigned int rng_state;     /* before the next block was drawn */
+    };
+    LockDelta undo_ring[UNDO_NUM];
+    int undo_head; /* slot of the next delta */
+    int undo_num;
+
+    /*
+     * glyphs of each row without the active block, built by render_line() on
+     * first use and only rebuilt once free_block(), clear_line() or undo()
+     * changed the row; the cached rows move with the rows they belong to
+     */
+    std::vector<std::string> glyph_rows;
+    std::vector<char> glyph_stale;
+
+    /*
+     * top and filled cells of each column, kept up to date by free_block(),
+     * clear_line() and undo(), so a placement is rated from the columns of
+     * the block instead of a scan of the board, see placement_features()
+     */
+    std::vector<int> col_top;  /* first non-free row, height() - 1 when empty */
+    std::vector<int> col_fill; /* filled cells above the floor */
+    int board_feat[FEAT_NUM];
+    bool feat_stale;
+
+    /* telemetry of this game, rows go to _telemetry in batches */
+    unsigned int game_seed;
+    unsigned int game_id;
+    int game_pieces;
+    long long spawn_us; /* when the block was spawned */
+    std::vector<long long> log_rows;
+    void log_piece(int type, int rotation, int pos_y, int pos_x, int lines);
 
     int getRandom(int min, int max);
-    void dump(char * ptr[]);
+    int col_height(int col) const {
+        return col < 1 || col > width() - 2 ? height() : height() - 1 - col_top[col];
+    }
+    void fill_cell(int row, int col);
+    void empty_cell(int row, int col);
+    void find_top(int col, int row);
+    void update_features();
+    int drop_block(int type, int rotation, int pos_x);
+    void placement_features(int type, int rotation, int pos_y, int pos_x, int *feat);
+    bool fit_block(int type, int rotation, int pos_y, int pos_x);
+    void put_block(int type, int rotation, int pos_y, int pos_x, char value);
+    void scan_features(int *feat);
+    bool check_placement(int type, int rotation, int pos_y, int pos_x, const int *feat);
+    bool check_columns();
+    void dump();
 };
 
-Board::Board(char ch) {
+template <int H, int W>
+Board<H, W>::Board(char ch, unsigned int seed) {
     blkCh = ch;
+    rng_state = game_seed = seed;
     debug("Board() blkCh = %d", blkCh);
     if (!ch) return;
     delay_ms = level2delay(0);
@@ -479,139 +1084,154 @@ Board::Board(char ch) {
     isPaused = false;
     isGameOver = false;
     next_blk_type = next_blk_rota = -1;
+    lock_y = 0;
+    spawn_rota = 0;
+    undo_head = undo_num = 0;
 
-    dataM = new Matrix(HEIGHT, WIDTH);
+    dataM = new Matrix<H, W>(HEIGHT, WIDTH);
 
-    size_t row, col;
-    for (row = 0; row < HEIGHT; row++) {
-        for (col = 0; col < WIDTH; col++) {
-            if ((col == 0) || (col == WIDTH - 1) || (row == HEIGHT - 1)) {
-                dataM->setValue(row, col, POS_BORDER);
-            } else {
-                dataM->setValue(row, col, POS_FREE);
-            }
-        }
+    std::vector<char> blank(width(), POS_FREE);
+    blank[0] = blank[width() - 1] = POS_BORDER;
+    dataM->setBlankRow(blank.data());
+
+    int col;
+    for (col = 1; col < width() - 1; col++) {
+        dataM->setValue(height() - 1, col, POS_BORDER);
     }
+    glyph_rows.resize(height());
+    glyph_stale.assign(height(), 1);
+    col_top.assign(width(), height() - 1);
+    col_fill.assign(width(), 0);
+    feat_stale = true;
+    game_pieces = 0;
+    spawn_us = 0;
+    if (_telemetry) game_id = _telemetry->new_game();
 }
 
-Board::~Board() {
+template <int H, int W>
+Board<H, W>::~Board() {
+    if (_telemetry && dataM) {
+        long long game[GAME_COLS] = {game_id, game_seed, game_pieces, score, delay2level(delay_ms)};
+        if (!log_rows.empty()) _telemetry->add(LOG_PIECE, log_rows.data(), log_rows.size() / PIECE_COLS);
+        _telemetry->add(LOG_GAME, game, 1);
+    }
     delete p_block;
     delete dataM;
     debug("~Board() dataM = %p, blkCh = %d", dataM, blkCh);
 }
 
-void Board::put_data_array(char *array[]) {
-    size_t row, col;
-    for (row = 0; row < HEIGHT; row++) {
-        for (col = 0; col < WIDTH; col++) {
-            array[row][col] += dataM->getValue(row, col);
-        }
-    }
-}
-
-void Board::dump(char * ptr[]) {
-    size_t row, col;
-    for (row = 0; row < HEIGHT; row++) {
-        for (col = 0; col < WIDTH; col++) {
-            debug("data[%d][%d] = %d", row, col, ptr ? ptr[row][col] : dataM->getValue(row, col));
+template <int H, int W>
+void Board<H, W>::dump() {
+    int row, col;
+    for (row = 0; row < height(); row++) {
+        for (col = 0; col < width(); col++) {
+            debug("data[%d][%d] = %d", row, col, dataM->getValue(row, col));
         }
     }
 }
 
-int Board::getRandom(int min, int max) {
-    return rand() % (max - min + 1) + min;
+template <int H, int W>
+int Board<H, W>::getRandom(int min, int max) {
+    rng_state = rng_state * 1103515245u + 12345u;
+    return ((rng_state >> 16) & 0x7fff) % (max - min + 1) + min;
 }
 
-void Board::new_block() {
+template <int H, int W>
+void Board<H, W>::new_block() {
     int type = next_blk_type;
     int rotation = next_blk_rota;
     if (!p_block) {
         if (type < 0) type = getRandom(0, 6);
         if (rotation < 0) rotation = getRandom(0, 3);
         int pos_x = 0;
-        int pos_y = WIDTH/2-2;
+        int pos_y = width()/2-2;
         p_block = new Block(type, rotation, pos_x, pos_y);
+        spawn_rota = rotation;
+        if (_telemetry) spawn_us = get_us();
     }
     next_blk_type = getRandom(0, 6);
     next_blk_rota = getRandom(0, 3);
 }
 
-void Board::free_block() {
+template <int H, int W>
+void Board<H, W>::free_block() {
     if (!p_block) {
         return;
     }
-/*
-    char *data;
-    int data_size = HEIGHT * WIDTH * sizeof(*data);
-    data = malloc(data_size);
-    memset(data, 0, data_size);
-    char (*array)[];
-    array = malloc(HEIGHT * sizeof(*array));
-    for (size_t i = 0; i<HEIGHT; i++) {
-        array[i] = &data[i * WIDTH];
-    }
-*/
-    Matrix mat(HEIGHT, WIDTH);
-    char **array = mat.allocArray();
-
-    p_block->put_data_array(array, true);
 
-    size_t row, col;
-    for (row = 0; row < HEIGHT - 1; row++) {
-        for (col = 1; col < WIDTH - 1; col++) {
-            if (array[row][col]) dataM->setValue(row, col, POS_FILLED);
+    LockDelta &delta = undo_ring[undo_head];
+    int type, rotation, pos_y, pos_x, row, col, y, x;
+    p_block->get_info(type, rotation, pos_y, pos_x);
+    lock_y = pos_y < 0 ? 0 : pos_y;
+    delta.type = type;
+    delta.rotation = spawn_rota;
+    delta.cell_num = delta.line_num = 0;
+    for (row = 0; row < 4; row++) {
+        y = pos_y + row;
+        if (y < 0 || y >= height() - 1) continue;
+        for (col = 0; col < 4; col++) {
+            x = pos_x + col;
+            if (!p_block->cell(row, col) || x < 1 || x >= width() - 1) continue;
+            if (dataM->getValue(y, x) != POS_FREE) continue;
+            delta.cells[(int)delta.cell_num][0] = y;
+            delta.cells[(int)delta.cell_num++][1] = x;
+            dataM->setValue(y, x, POS_FILLED);
+            glyph_stale[y] = 1;
+            fill_cell(y, x);
         }
     }
     delete p_block;
     p_block = NULL;
-/*
-    free(data);
-    free(array);
-*/
-    mat.freeArray();
 }
 
-/* return 0: success, 2: right-collided, 3: left-collided, -1: failure */
-int Board::check_block_data(char *array[], bool rotate) {
+/*
+ * Only the 4x4 cells of the block are checked against the board.
+ * return 0: success, 2: right-collided, 3: left-collided, -1: failure
+ */
+template <int H, int W>
+int Board<H, W>::check_block(bool rotate) {
+    int type, rotation, pos_y, pos_x, row, col, y, x;
     int collided = 0;
-    size_t row, col;
-    for (row = 0; row < HEIGHT; row++) {
-        for (col = 0; col < WIDTH; col++) {
-            if (dataM->getValue(row, col) && array[row][col]) {
-                if (array[row][col] == 1) return -1;
-                if (!collided) collided = rotate ? array[row][col] : 1;
-                if (collided == array[row][col]) continue;
-                return -1;
-            }
+    char value;
+
+    p_block->get_info(type, rotation, pos_y, pos_x);
+    for (row = 0; row < 4; row++) {
+        y = pos_y + row;
+        if (y < 0 || y >= height()) continue;
+        for (col = 0; col < 4; col++) {
+            x = pos_x + col;
+            value = p_block->cell(row, col);
+            if (!value || x < 0 || x >= width()) continue;
+            if (!dataM->getValue(y, x)) continue;
+            if (value == 1) return -1;
+            if (!collided) collided = rotate ? value : 1;
+            if (collided == value) continue;
+            return -1;
         }
     }
     return collided;
 }
 
-int Board::move_block(int action) {
+template <int H, int W>
+int Board<H, W>::move_block(int action) {
     if (!p_block) {
         return STAT_NORMAL;
     }
 
-    int collide;
+    int collide, kick = MOVE_NONE;
     bool is_rotate = (action == MOVE_ROTATE);
-    //char array[HEIGHT][WIDTH];
-    Matrix mat(HEIGHT, WIDTH);
-    char **array = mat.allocArray();
 
     p_block->backup();
     do {
         p_block->move(action);
-        //memset(array, 0, sizeof(array));
-        mat.reset();
-        p_block->put_data_array(array, false);
-        collide = check_block_data(array, is_rotate);
+        collide = check_block(is_rotate);
         if (collide == POS_FILLED_2) action = MOVE_LEFT;
         if (collide == POS_FILLED_3) action = MOVE_RIGHT;
+        /* kicked back and forth between both sides: no room to rotate */
+        if (collide > 1 && kick != MOVE_NONE && kick != action) collide = -1;
+        if (collide > 1) kick = action;
     } while(collide > 1);
 
-    mat.freeArray();
-
     if (collide < 0) {
         p_block->restore();
         switch (action) {
@@ -628,36 +1248,127 @@ int Board::move_block(int action) {
     return STAT_NORMAL;
 }
 
-int Board::clear_line() {
-    int index, clear_lines = 0;
-    size_t row, col;
+/* only the rows of the last locked block can have become full */
+template <int H, int W>
+int Board<H, W>::clear_line() {
+    int index, col, clear_lines = 0;
 
-    for (index = HEIGHT - 2; index >= 0; index--) {
-        for (col = 1; col < WIDTH - 1; col++) {
-            if (dataM->getValue(index, col) == POS_FREE) {
-                break;
-            }
-        }
-        if (col < WIDTH - 1) continue;
+    index = lock_y + 3 < height() - 2 ? lock_y + 3 : height() - 2;
+    for (; index >= lock_y; index--) {
+        if (dataM->countRow(index) < width()) continue;
 
         // Moves all the upper lines one row down
-        for (row = index; row > 0; row--) {
-            for (col = 1; col < WIDTH - 1; col++) {
-                dataM->setValue(row, col, dataM->getValue(row-1, col));
+        dataM->shiftDown(index);
+        std::rotate(glyph_rows.begin(), glyph_rows.begin() + index, glyph_rows.begin() + index + 1);
+        std::rotate(glyph_stale.begin(), glyph_stale.begin() + index, glyph_stale.begin() + index + 1);
+        glyph_stale[0] = 1;
+        for (col = 1; col < width() - 1; col++) {
+            col_fill[col]--;
+            if (col_top[col] < index) {
+                col_top[col]++;
+            } else {
+                find_top(col, index + 1);
             }
         }
+        feat_stale = true;
+        undo_ring[undo_head].lines[clear_lines] = index;
         clear_lines ++;
         index ++;
-        if (clear_lines > 1) continue;
-        for (col = 1; col < WIDTH - 1; col++) {
-            dataM->setValue(0, col, POS_FREE);
-        }
     }
+    undo_ring[undo_head].line_num = clear_lines;
     score += clear_lines;
     return clear_lines;
 }
 
-void Board::clear_screen() {
+/*
+ * Lock the landed block, clear lines and spawn the next block. The changes
+ * are kept as a small delta in a ring of the last UNDO_NUM locks, so undo()
+ * costs only the cells and lines of each block, never a board copy.
+ * return the lines cleared
+ */
+template <int H, int W>
+int Board<H, W>::lock_block() {
+    LockDelta &delta = undo_ring[undo_head];
+    int lines, type, rotation, pos_y, pos_x;
+    bool locked = p_block != NULL;
+
+    if (locked) p_block->get_info(type, rotation, pos_y, pos_x);
+    free_block();
+    lines = clear_line();
+    if (_telemetry && locked) log_piece(type, rotation, pos_y, pos_x, lines);
+    delta.next_type = next_blk_type;
+    delta.next_rota = next_blk_rota;
+    delta.rng_state = rng_state;
+    undo_head = (undo_head + 1) % UNDO_NUM;
+    if (undo_num < UNDO_NUM) undo_num++;
+
+    new_block();
+    move_block(MOVE_NONE);
+    update_game_over();
+    return lines;
+}
+
+/* a row for the telemetry log, the stack is measured after the clear */
+template <int H, int W>
+void Board<H, W>::log_piece(int type, int rotation, int pos_y, int pos_x, int lines) {
+    int col, stack = 0;
+
+    for (col = 1; col < width() - 1; col++) stack = std::max(stack, col_height(col));
+    long long row[PIECE_COLS] = {game_id, game_seed, type, rotation, pos_x, pos_y, lines, stack,
+                                 get_us() - spawn_us, delay2level(delay_ms)};
+    log_rows.insert(log_rows.end(), row, row + PIECE_COLS);
+    game_pieces++;
+    if (log_rows.size() >= 256 * PIECE_COLS) {
+        _telemetry->add(LOG_PIECE, log_rows.data(), log_rows.size() / PIECE_COLS);
+        log_rows.clear();
+    }
+}
+
+/* take back the last locked blocks, return how many were undone */
+template <int H, int W>
+int Board<H, W>::undo(int count) {
+    std::vector<char> full(width(), POS_FILLED);
+    int n, i, col;
+
+    full[0] = full[width() - 1] = POS_BORDER;
+    for (n = 0; n < count && undo_num > 0; n++) {
+        undo_head = (undo_head + UNDO_NUM - 1) % UNDO_NUM;
+        undo_num--;
+        LockDelta &delta = undo_ring[undo_head];
+
+        for (i = delta.line_num - 1; i >= 0; i--) {
+            dataM->insertRow(delta.lines[i], full.data());
+            std::rotate(glyph_rows.begin(), glyph_rows.begin() + 1, glyph_rows.begin() + delta.lines[i] + 1);
+            std::rotate(glyph_stale.begin(), glyph_stale.begin() + 1, glyph_stale.begin() + delta.lines[i] + 1);
+            glyph_stale[delta.lines[i]] = 1;
+            for (col = 1; col < width() - 1; col++) {
+                col_fill[col]++;
+                col_top[col] = std::min(col_top[col] - 1, (int)delta.lines[i]);
+            }
+        }
+        for (i = 0; i < delta.cell_num; i++) {
+            dataM->setValue(delta.cells[i][0], delta.cells[i][1], POS_FREE);
+            glyph_stale[delta.cells[i][0]] = 1;
+            empty_cell(delta.cells[i][0], delta.cells[i][1]);
+        }
+        feat_stale = true;
+        score -= delta.line_num;
+        next_blk_type = delta.next_type;
+        next_blk_rota = delta.next_rota;
+        rng_state = delta.rng_state;
+
+        delete p_block;
+        p_block = new Block(delta.type, delta.rotation, 0, width()/2-2);
+        spawn_rota = delta.rotation;
+        if (_telemetry) spawn_us = get_us();
+        isGameOver = false;
+    }
+    assert(check_columns());
+    return n;
+}
+
+template <int H, int W>
+void Board<H, W>::clear_screen() {
 #ifdef _WIN32
     system("cls");
 #else
@@ -665,179 +1376,1135 @@ void Board::clear_screen() {
 #endif
 }
 
-void Board::refresh_screen(bool clear) {
-    //char array[HEIGHT][WIDTH];
-    //memset(array, 0, sizeof(array));
-    Matrix mat(HEIGHT, WIDTH);
-    char **array = mat.allocArray();
-    mat.reset();
+/* the new block overlapping the stack means game over, a quit game stays over */
+template <int H, int W>
+bool Board<H, W>::update_game_over() {
+    if (!p_block) return isGameOver;
 
-    put_data_array(array);
-
-    if (p_block) {
-        isGameOver = p_block->put_data_array(array, true);
+    int type, rotation, pos_y, pos_x, row, col, y, x;
+    p_block->get_info(type, rotation, pos_y, pos_x);
+    for (row = 0; row < 4; row++) {
+        y = pos_y + row;
+        if (y < 0 || y >= height()) continue;
+        for (col = 0; col < 4; col++) {
+            x = pos_x + col;
+            if (!p_block->cell(row, col) || x < 0 || x >= width()) continue;
+            if (dataM->getValue(y, x)) isGameOver = true;
+        }
     }
+    return isGameOver;
+}
 
-    if (clear) clear_screen();
-
-    bool std_output = false;
-#ifdef _WIN32
-    std_output = true;
-#else
-    if (!clear) std_output = true;
-#endif
-
-    char title[] = "    Tetris Speed ";
-    if (std_output)
-        std::cout << title << delay2level(delay_ms) << std::endl;
-    else
-        output("%s%d\n", title, delay2level(delay_ms));
+template <int H, int W>
+int Board<H, W>::get_score() {
+    return score;
+}
 
-    char tips_buffer[4 + 8 + 1] = {0};
-    char buffer[50 * 2 + 1] = {0};
-    assert(WIDTH <= 50);
+template <int H, int W>
+bool Board<H, W>::get_block_info(int &type, int &rotation, int &pos_y, int &pos_x) {
+    if (!p_block) return false;
+    p_block->get_info(type, rotation, pos_y, pos_x);
+    return true;
+}
 
-    size_t t = next_blk_type, r = next_blk_rota, i, j;
-    for (i = 0; i < HEIGHT; i++) {
-        for (j = 0; j < WIDTH; j++) {
-            switch (array[i][j]) {
-            case POS_FREE: //Empty
-                //std::cout << "  ";
-                buffer[j * 2] = buffer[j * 2 + 1] = ' ';
-                break;
-            case POS_FILLED: //Block
-                //std::cout << blkCh << blkCh;
-                buffer[j * 2] = buffer[j * 2 + 1] = blkCh;
-                break;
-            case POS_BORDER: //Border
-                //std::cout << "$$";
-                buffer[j * 2] = buffer[j * 2 + 1] = '$';
-                break;
-            }
+/* one line per turn, see "Bot protocol" */
+template <int H, int W>
+void Board<H, W>::put_state(FILE *fp) {
+    int type = -1, rotation = -1, pos_y = 0, pos_x = 0;
+    get_block_info(type, rotation, pos_y, pos_x);
+    int top = height() - 1, row, col;
+
+    for (col = 1; col < width() - 1; col++) top = std::min(top, col_top[col]);
+    fprintf(fp, "S %d %d %d %d %d %d %d %d %d %d ", score, type, rotation, pos_y, pos_x,
+            next_blk_type, next_blk_rota, height(), width(), top);
+
+    std::string cells((height() - top) * width(), '0');
+    for (row = top; row < height(); row++) {
+        for (col = 0; col < width(); col++) {
+            cells[(row - top) * width() + col] += dataM->getValue(row, col);
         }
-        if (_tips && (i < 4) && (t < KIND_NUM) && (r < DIRECT_NUM)) {
-            for (j = 0; j < 4; j++) {tips_buffer[j] = ' ';}
-            for (j = 0; j < 4; j++) {tips_buffer[4 + j*2] = tips_buffer[5 + j*2] = defBlocks[t][r][i][j] ? blkCh:' ';}
-            tips_buffer[12] = '\0';
-        } else {
-            tips_buffer[0] = '\0';
-        }
-
-        if (std_output)
-            std::cout << buffer << tips_buffer << std::endl;
-        else
-            output("%s%s\n", buffer, tips_buffer);
     }
-    if (std_output)
-        std::cout << "    Score: " << score << std::endl;
-    else
-        output("    Score: %d\n", score);
+    fputs(cells.c_str(), fp);
+    fputc('\n', fp);
+}
 
-    mat.freeArray();
+template <int H, int W>
+void Board<H, W>::fill_cell(int row, int col) {
+    col_fill[col]++;
+    if (row < col_top[col]) col_top[col] = row;
+    feat_stale = true;
 }
 
-void Board::set_game_pause() {
-    isPaused = !isPaused;
+template <int H, int W>
+void Board<H, W>::empty_cell(int row, int col) {
+    col_fill[col]--;
+    if (row == col_top[col]) find_top(col, row + 1);
+    feat_stale = true;
 }
 
-bool Board::is_game_pause() {
-    return isPaused;
+/* the cells above row are free, the floor ends the search */
+template <int H, int W>
+void Board<H, W>::find_top(int col, int row) {
+    while (row < height() - 1 && dataM->getValue(row, col) == POS_FREE) row++;
+    col_top[col] = row;
 }
 
-void Board::set_game_over() {
-    isGameOver = !isGameOver;
+template <int H, int W>
+void Board<H, W>::update_features() {
+    int col, level;
+
+    memset(board_feat, 0, sizeof(board_feat));
+    for (col = 1; col < width() - 1; col++) {
+        board_feat[FEAT_HEIGHTS] += col_height(col);
+        board_feat[FEAT_HOLES] += col_height(col) - col_fill[col];
+        if (col < width() - 2) board_feat[FEAT_BUMPINESS] += abs(col_height(col) - col_height(col + 1));
+        level = std::min(col_height(col - 1), col_height(col + 1)) - col_height(col);
+        if (level > 0) board_feat[FEAT_WELLS] += level;
+    }
+    feat_stale = false;
 }
 
-bool Board::is_game_over() {
-    return isGameOver;
+/* there are no full rows between two blocks, so nothing needs to be skipped */
+template <int H, int W>
+void Board<H, W>::get_features(int *feat) {
+    if (feat_stale) update_features();
+    memcpy(feat, board_feat, sizeof(board_feat));
 }
 
-////////////////////////////////////////////////////////
-class Frame
-{
-public:
-    Frame(int delay, char ch);
-    ~Frame(){delete m_board;}
-    void start();
+/* row where the block lands dropped straight down from the top, -1 if it does not fit */
+template <int H, int W>
+int Board<H, W>::drop_block(int type, int rotation, int pos_x) {
+    int row, col, pos_y = height();
+
+    for (col = 0; col < 4; col++) {
+        for (row = 3; row >= 0 && !defBlocks[type][rotation][row][col]; row--);
+        if (row < 0) continue;
+        if (pos_x + col < 1 || pos_x + col > width() - 2) return -1;
+        pos_y = std::min(pos_y, col_top[pos_x + col] - 1 - row);
+    }
+    return pos_y;
+}
+
+/*
+ * Features of the board with the block locked at pos_y, pos_x and its full
+ * rows cleared. Only the columns of the block and their neighbours change,
+ * unless rows are cleared: then every column is looked at once, which is a
+ * handful of the candidates of a block.
+ */
+template <int H, int W>
+void Board<H, W>::placement_features(int type, int rotation, int pos_y, int pos_x, int *feat) {
+    int top[4], cells[4], row, col, y, n, lines = 0, above, level;
+    bool full[4];
+    const int floor = height() - 1;
+
+    for (col = 0; col < 4; col++) {
+        top[col] = floor;
+        cells[col] = 0;
+    }
+    for (row = 0; row < 4; row++) {
+        for (n = 0, col = 0; col < 4; col++) {
+            if (!defBlocks[type][rotation][row][col]) continue;
+            top[col] = std::min(top[col], pos_y + row);
+            cells[col]++;
+            n++;
+        }
+        full[row] = n && dataM->countRow(pos_y + row) + n == width();
+        lines += full[row];
+    }
+    get_features(feat);
+    feat[FEAT_LINES] = lines;
+
+    if (lines == 0) {
+        int old_h[8], new_h[8]; /* columns pos_x - 2 .. pos_x + 5 */
+        for (col = 0; col < 8; col++) {
+            old_h[col] = new_h[col] = col_height(pos_x - 2 + col);
+        }
+        for (col = 0; col < 4; col++) {
+            if (!cells[col]) continue;
+            new_h[col + 2] = floor - std::min(col_top[pos_x + col], top[col]);
+            feat[FEAT_HEIGHTS] += new_h[col + 2] - old_h[col + 2];
+            feat[FEAT_HOLES] += new_h[col + 2] - old_h[col + 2] - cells[col];
+        }
+        for (col = std::max(1, pos_x - 1); col <= std::min(width() - 2, pos_x + 4); col++) {
+            y = col - pos_x + 2;
+            if (col < width() - 2) {
+                feat[FEAT_BUMPINESS] += abs(new_h[y] - new_h[y + 1]) - abs(old_h[y] - old_h[y + 1]);
+            }
+            level = std::min(new_h[y - 1], new_h[y + 1]) - new_h[y];
+            feat[FEAT_WELLS] += std::max(level, 0);
+            level = std::min(old_h[y - 1], old_h[y + 1]) - old_h[y];
+            feat[FEAT_WELLS] -= std::max(level, 0);
+        }
+        return;
+    }
+
+    /* a column only differs from "lines lower" below a cleared top */
+    std::vector<int> heights(width(), height());
+    feat[FEAT_HEIGHTS] = feat[FEAT_HOLES] = feat[FEAT_BUMPINESS] = feat[FEAT_WELLS] = 0;
+    for (col = 1; col < width() - 1; col++) {
+        bool block = col >= pos_x && col < pos_x + 4 && cells[col - pos_x];
+        y = block ? std::min(col_top[col], top[col - pos_x]) : col_top[col];
+        for (; y < floor; y++) {
+            row = y - pos_y;
+            if (row >= 0 && row < 4 && full[row]) continue;
+            if (dataM->getValue(y, col) != POS_FREE) break;
+            if (block && row >= 0 && row < 4 && defBlocks[type][rotation][row][col - pos_x]) break;
+        }
+        for (above = 0, row = 0; row < 4 && pos_y + row < y; row++) above += full[row];
+        heights[col] = floor - y - (lines - above);
+        feat[FEAT_HEIGHTS] += heights[col];
+        feat[FEAT_HOLES] += heights[col] - (col_fill[col] + (block ? cells[col - pos_x] : 0) - lines);
+    }
+    for (col = 1; col < width() - 1; col++) {
+        if (col < width() - 2) feat[FEAT_BUMPINESS] += abs(heights[col] - heights[col + 1]);
+        level = std::min(heights[col - 1], heights[col + 1]) - heights[col];
+        if (level > 0) feat[FEAT_WELLS] += level;
+    }
+}
+
+/*
+ * The features of a full scan of the board, without col_top and col_fill;
+ * debug builds check placement_features() against it, see find_placement().
+ * Full rows count as cleared and are skipped.
+ */
+template <int H, int W>
+void Board<H, W>::scan_features(int *feat) {
+    std::vector<int> heights(width(), height());
+    int row, col, level, top;
+
+    memset(feat, 0, FEAT_NUM * sizeof(feat[0]));
+    for (col = 1; col < width() - 1; col++) {
+        top = -1;
+        for (row = 0, level = 0; row < height() - 1; row++) {
+            if (dataM->countRow(row) == width()) continue;
+            if (dataM->getValue(row, col) != POS_FREE) {
+                if (top < 0) top = level;
+            } else if (top >= 0) {
+                feat[FEAT_HOLES]++;
+            }
+            level++;
+        }
+        heights[col] = top < 0 ? 0 : level - top;
+        feat[FEAT_HEIGHTS] += heights[col];
+    }
+    for (row = 0; row < height() - 1; row++) {
+        if (dataM->countRow(row) == width()) feat[FEAT_LINES]++;
+    }
+    for (col = 1; col < width() - 1; col++) {
+        if (col < width() - 2) feat[FEAT_BUMPINESS] += abs(heights[col] - heights[col + 1]);
+        level = std::min(heights[col - 1], heights[col + 1]) - heights[col];
+        if (level > 0) feat[FEAT_WELLS] += level;
+    }
+}
+
+template <int H, int W>
+bool Board<H, W>::fit_block(int type, int rotation, int pos_y, int pos_x) {
+    int row, col, y, x;
+    for (row = 0; row < 4; row++) {
+        for (col = 0; col < 4; col++) {
+            if (!defBlocks[type][rotation][row][col]) continue;
+            y = pos_y + row;
+            x = pos_x + col;
+            if (y < 0 || y >= height() || x < 0 || x >= width()) return false;
+            if (dataM->getValue(y, x) != POS_FREE) return false;
+        }
+    }
+    return true;
+}
+
+template <int H, int W>
+void Board<H, W>::put_block(int type, int rotation, int pos_y, int pos_x, char value) {
+    int row, col;
+    for (row = 0; row < 4; row++) {
+        for (col = 0; col < 4; col++) {
+            if (defBlocks[type][rotation][row][col]) dataM->setValue(pos_y + row, pos_x + col, value);
+        }
+    }
+}
+
+/* drop the block cell by cell, lock it, scan the board: the same row and features? */
+template <int H, int W>
+bool Board<H, W>::check_placement(int type, int rotation, int pos_y, int pos_x, const int *feat) {
+    int y, scan[FEAT_NUM];
+
+    if (!fit_block(type, rotation, 0, pos_x)) return false;
+    for (y = 0; fit_block(type, rotation, y + 1, pos_x); y++);
+    if (y != pos_y) return false;
+
+    put_block(type, rotation, y, pos_x, POS_FILLED);
+    scan_features(scan);
+    put_block(type, rotation, y, pos_x, POS_FREE);
+    return memcmp(scan, feat, sizeof(scan)) == 0;
+}
+
+/* col_top and col_fill against a scan of every column */
+template <int H, int W>
+bool Board<H, W>::check_columns() {
+    int row, col, top, fill;
+
+    for (col = 1; col < width() - 1; col++) {
+        for (top = -1, fill = 0, row = 0; row < height() - 1; row++) {
+            if (dataM->getValue(row, col) == POS_FREE) continue;
+            if (top < 0) top = row;
+            fill++;
+        }
+        if (col_top[col] != (top < 0 ? height() - 1 : top) || col_fill[col] != fill) return false;
+    }
+    return true;
+}
+
+/*
+ * Try every rotation and column of the current block dropped straight down
+ * from the top, return the one whose board rates best with the weights.
+ */
+template <int H, int W>
+bool Board<H, W>::find_placement(const double *weights, int &rotation, int &pos_x) {
+    int type, rota, y, x, i, feat[FEAT_NUM];
+    double value, best = 0;
+    bool found = false;
+
+    if (!get_block_info(type, rota, y, x)) return false;
+    for (rota = 0; rota < DIRECT_NUM; rota++) {
+        for (x = -3; x < width(); x++) {
+            y = drop_block(type, rota, x);
+            if (y < 0) continue;
+            placement_features(type, rota, y, x, feat);
+            /* the column features kept by clear_line() and undo() against a full scan */
+            assert(check_placement(type, rota, y, x, feat));
+
+            for (value = 0, i = 0; i < FEAT_NUM; i++) value += weights[i] * feat[i];
+            if (!found || value > best) {
+                found = true;
+                best = value;
+                rotation = rota;
+                pos_x = x;
+            }
+        }
+    }
+    return found;
+}
+
+/* 2 chars per cell of row, from column left on, with the block drawn on top */
+template <int H, int W>
+void Board<H, W>::render_line(int row, int left, int count, char *buffer) {
+    std::string &glyphs = glyph_rows[row];
+    int type, rotation, pos_y, pos_x, j, k;
+
+    if (glyph_stale[row]) {
+        const char *line = dataM->getRow(row);
+        glyphs.resize(width() * 2);
+        for (j = 0, k = 0; j < width(); j++, k += 2) {
+            switch (line[j]) {
+            case POS_FREE: //Empty
+                //std::cout << "  ";
+                glyphs[k] = glyphs[k + 1] = ' ';
+                break;
+            case POS_FILLED: //Block
+                //std::cout << blkCh << blkCh;
+                glyphs[k] = glyphs[k + 1] = blkCh;
+                break;
+            case POS_BORDER: //Border
+                //std::cout << "$$";
+                glyphs[k] = glyphs[k + 1] = '$';
+                break;
+            }
+        }
+        glyph_stale[row] = 0;
+    }
+    memcpy(buffer, glyphs.data() + left * 2, count * 2);
+    if (!p_block) return;
+    p_block->get_info(type, rotation, pos_y, pos_x);
+    if (row < pos_y || row >= pos_y + 4) return;
+    for (j = 0; j < 4; j++) {
+        if (!p_block->cell(row - pos_y, j) || pos_x + j < left || pos_x + j >= left + count) continue;
+        k = (pos_x + j - left) * 2;
+        buffer[k] = buffer[k + 1] = blkCh;
+    }
+}
+
+template <int H, int W>
+void Board<H, W>::refresh_screen(bool clear) {
+    int type = -1, rotation = 0, pos_y = 0, pos_x = 0;
+    if (p_block) {
+        update_game_over();
+        p_block->get_info(type, rotation, pos_y, pos_x);
+    }
+
+    if (clear) clear_screen();
+
+    bool std_output = false;
+#ifdef _WIN32
+    std_output = true;
+#else
+    if (!clear) std_output = true;
+#endif
+
+    /* a board larger than the terminal only shows the part around the block */
+    int view_h = height(), view_w = width(), top = 0, left = 0, rows, cols;
+    get_view_size(rows, cols);
+    if (rows > 3 && rows - 3 < view_h) {
+        view_h = rows - 3;
+        top = std::max(0, std::min(pos_y + 2 - view_h / 2, height() - view_h));
+    }
+    if (_tips) cols -= 12;
+    /* a full width line would wrap before its newline */
+    if (cols >= 8 && (cols - 1) / 2 < view_w) {
+        view_w = (cols - 1) / 2;
+        left = std::max(0, std::min(pos_x + 2 - view_w / 2, width() - view_w));
+    }
+
+    char title[] = "    Tetris Speed ";
+    char view[64] = {0};
+    if (view_h < height() || view_w < width()) {
+        snprintf(view, sizeof(view), "  rows %d-%d/%d cols %d-%d/%d",
+                 top + 1, top + view_h, height(), left + 1, left + view_w, width());
+    }
+    if (std_output)
+        std::cout << title << delay2level(delay_ms) << view << std::endl;
+    else
+        output("%s%d%s\n", title, delay2level(delay_ms), view);
+
+    char tips_buffer[4 + 8 + 1] = {0};
+    std::vector<char> buffer(view_w * 2 + 1, 0);
+
+    size_t t = next_blk_type, r = next_blk_rota;
+    int i, j;
+    for (i = top; i < top + view_h; i++) {
+        render_line(i, left, view_w, buffer.data());
+        if (_tips && (i - top < 4) && (t < KIND_NUM) && (r < DIRECT_NUM)) {
+            for (j = 0; j < 4; j++) {tips_buffer[j] = ' ';}
+            for (j = 0; j < 4; j++) {tips_buffer[4 + j*2] = tips_buffer[5 + j*2] = defBlocks[t][r][i - top][j] ? blkCh:' ';}
+            tips_buffer[12] = '\0';
+        } else {
+            tips_buffer[0] = '\0';
+        }
+
+        if (std_output)
+            std::cout << buffer.data() << tips_buffer << std::endl;
+        else
+            output("%s%s\n", buffer.data(), tips_buffer);
+    }
+    if (std_output)
+        std::cout << "    Score: " << score << std::endl;
+    else
+        output("    Score: %d\n", score);
+#ifndef _WIN32
+    /* getch() is only called when a key is pending, it can not be left to flush */
+    if (!std_output) refresh();
+#endif
+}
+
+template <int H, int W>
+void Board<H, W>::set_game_pause() {
+    isPaused = !isPaused;
+}
+
+template <int H, int W>
+bool Board<H, W>::is_game_pause() {
+    return isPaused;
+}
+
+template <int H, int W>
+void Board<H, W>::set_game_over() {
+    isGameOver = !isGameOver;
+}
+
+template <int H, int W>
+bool Board<H, W>::is_game_over() {
+    return isGameOver;
+}
+
+////////////////////////////////////////////////////////
+/* a coroutine run by the Scheduler, owner groups the tasks of one game */
+struct Task
+{
+    struct promise_type {
+        void *owner = NULL;
+
+        Task get_return_object() {return Task{std::coroutine_handle<promise_type>::from_promise(*this)};}
+        std::suspend_always initial_suspend() noexcept {return {};}
+        std::suspend_always final_suspend() noexcept {return {};}
+        void return_void() {}
+        void unhandled_exception() {std::terminate();}
+    };
+    std::coroutine_handle<promise_type> handle;
+};
+
+/*
+ * Single threaded scheduler of cooperative tasks. A task suspends until a
+ * deadline, until a key is pending or until an Event is set, and run() sleeps
+ * in one poll() for the earliest of them, so any number of games share one
+ * thread without a busy loop.
+ */
+class Scheduler
+{
+public:
+    typedef std::coroutine_handle<Task::promise_type> Handle;
+
+    struct Wait {
+        Scheduler *sched;
+        long long deadline; /* -1: none */
+        bool input;
+
+        bool await_ready() const noexcept {return false;}
+        void await_suspend(Handle h) {sched->m_waiting.push_back({h, deadline, input});}
+        void await_resume() const noexcept {}
+    };
+    struct Yield {
+        Scheduler *sched;
+
+        bool await_ready() const noexcept {return false;}
+        void await_suspend(Handle h) {sched->m_ready.push_back(h);}
+        void await_resume() const noexcept {}
+    };
+
+    ~Scheduler();
+    void spawn(Task task, void *owner);
+    void run();
+    void wake(void *owner);
+    void resume(Handle h) {m_ready.push_back(h);}
+    /* resume at deadline in ms of get_ms() */
+    Wait until(long long deadline) {return Wait{this, deadline, false};}
+    /* resume when a key is pending, or at deadline */
+    Wait input(long long deadline = -1) {return Wait{this, deadline, true};}
+    /* resume after the other ready tasks */
+    Yield yield() {return Yield{this};}
+
+private:
+    struct Waiter {
+        Handle handle;
+        long long deadline;
+        bool input;
+    };
+    std::deque<Handle> m_ready;
+    std::vector<Waiter> m_waiting;
+    int m_tasks = 0;
+
+    bool wait_input(bool input, long long timeout);
+};
+
+/* a flag a task waits for, setting it again before the task ran is merged */
+class Event
+{
+public:
+    struct Wait {
+        Event *event;
+
+        bool await_ready() const noexcept {return event->m_set;}
+        void await_suspend(Scheduler::Handle h) {event->m_waiters.push_back(h);}
+        void await_resume() const noexcept {event->m_set = false;}
+    };
+
+    Event(Scheduler *sched = NULL) : m_sched(sched) {}
+    void set() {
+        size_t i;
+        m_set = true;
+        for (i = 0; i < m_waiters.size(); i++) m_sched->resume(m_waiters[i]);
+        m_waiters.clear();
+    }
+    Wait wait() {return Wait{this};}
+
+private:
+    Scheduler *m_sched;
+    std::vector<Scheduler::Handle> m_waiters;
+    bool m_set = false;
+};
+
+Scheduler::~Scheduler() {
+    size_t i;
+    for (i = 0; i < m_ready.size(); i++) m_ready[i].destroy();
+    for (i = 0; i < m_waiting.size(); i++) m_waiting[i].handle.destroy();
+}
+
+void Scheduler::spawn(Task task, void *owner) {
+    task.handle.promise().owner = owner;
+    m_ready.push_back(task.handle);
+    m_tasks++;
+}
+
+/* resume every waiting task of owner, e.g. to let them see the game is over */
+void Scheduler::wake(void *owner) {
+    size_t i;
+    for (i = 0; i < m_waiting.size(); ) {
+        if (m_waiting[i].handle.promise().owner == owner) {
+            m_ready.push_back(m_waiting[i].handle);
+            m_waiting.erase(m_waiting.begin() + i);
+        } else {
+            i++;
+        }
+    }
+}
+
+/* wait up to timeout ms (-1: forever), return true if input and a key is pending */
+bool Scheduler::wait_input(bool input, long long timeout) {
+#ifdef _WIN32
+    long long end = get_ms() + timeout;
+    while (!input || !kbhit()) {
+        if (timeout >= 0 && get_ms() >= end) return false;
+        Sleep(1);
+    }
+    return true;
+#else
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&fd, input ? 1 : 0, (int)timeout) > 0;
+#endif
+}
+
+void Scheduler::run() {
+    long long now, next;
+    bool input, want_input;
+    size_t i;
+
+    while (m_tasks > 0) {
+        while (!m_ready.empty()) {
+            Handle h = m_ready.front();
+            m_ready.pop_front();
+            h.resume();
+            if (h.done()) {
+                h.destroy();
+                m_tasks--;
+            }
+        }
+        if (m_waiting.empty()) break;
+
+        now = get_ms();
+        next = -1;
+        want_input = false;
+        for (i = 0; i < m_waiting.size(); i++) {
+            if (m_waiting[i].input) want_input = true;
+            if (m_waiting[i].deadline >= 0 && (next < 0 || m_waiting[i].deadline < next)) {
+                next = m_waiting[i].deadline;
+            }
+        }
+        if (next >= 0) next = next > now ? next - now : 0;
+        input = wait_input(want_input, next);
+
+        now = get_ms();
+        for (i = 0; i < m_waiting.size(); ) {
+            Waiter &w = m_waiting[i];
+            if ((w.input && input) || (w.deadline >= 0 && w.deadline <= now)) {
+                m_ready.push_back(w.handle);
+                m_waiting.erase(m_waiting.begin() + i);
+            } else {
+                i++;
+            }
+        }
+    }
+}
+
+/*
+ * Lock of a game on the dashboard: the game holds it while it plays a block,
+ * the dashboard while it copies the rows. A game that takes it right back
+ * lets a waiting dashboard go first, so a game at full speed can be watched.
+ */
+class GameLock
+{
+public:
+    void lock() {
+        while (m_waiting) std::this_thread::yield();
+        m_lock.lock();
+    }
+    void unlock() {m_lock.unlock();}
+    void lock_view() {
+        m_waiting = true;
+        m_lock.lock();
+        m_waiting = false;
+    }
+
+private:
+    std::mutex m_lock;
+    std::atomic<bool> m_waiting{false};
+};
+
+////////////////////////////////////////////////////////
+template <int H = 0, int W = 0>
+class Frame
+{
+public:
+    Frame(int delay, char ch, unsigned int seed = 1);
+    ~Frame(){delete m_board;}
+    void start();
+    void spawn(Scheduler &sched);
+    void spawn_auto(Scheduler &sched, const double *weights, GameLock *lock, const std::atomic<bool> *stop);
+    Board<H, W> *get_board() {return m_board;}
+    void start_pipe();
+    int start_auto(const double *weights, int max_blocks, GameLock *lock = NULL,
+                   const std::atomic<bool> *stop = NULL);
+    int start_replay(FILE *fp, unsigned int &checksum);
     void print_result();
-    int get_user_input();
+    int get_user_input(int key);
     bool is_timeout(int delay);
     void reset_timer();
 
 private:
-    Board *m_board = NULL;
-    struct timeval m_timer;
+    Board<H, W> *m_board = NULL;
+
+    /* consecutive identical moves of one frame, applied without rendering in between */
+    struct InputRun {
+        int action;
+        int count;
+    };
+    std::vector<InputRun> m_runs;
+    enum {
+        DAS_PRESSED, DAS_FIRST, DAS_HELD
+    };
+    int m_das_dir = MOVE_NONE;
+    int m_das_state = DAS_PRESSED;
+    bool m_das_pending = false; /* a first repeat within DAS, it shifts if it was a tap */
+    bool m_das_auto = false;
+    long long m_das_press = 0;
+    long long m_das_first = 0;
+    long long m_das_seen = 0;
+    long long m_das_next = 0;
+
+    Scheduler *m_sched = NULL;
+    Event m_dirty; /* the screen needs a refresh */
+    Event m_resume; /* the pause is over */
+
+    Task input_task();
+    Task gravity_task();
+    Task render_task();
+    Task auto_task(const double *weights, GameLock *lock, const std::atomic<bool> *stop);
+    void finish();
+    void toggle_pause();
+    void push_input(int action, int count);
+    void poll_user_input();
+    bool das_key(int action, long long now);
+    void das_repeat(long long now);
+    long long das_deadline();
+    int play_action(int action);
+    void place_block(int rotation, int pos_x);
+    bool pipe_command(const char *cmd);
+    long long m_timer;
 };
 
-Frame::Frame(int delay, char ch) {
-    if (!m_board) m_board = new Board(ch);
+template <int H, int W>
+Frame<H, W>::Frame(int delay, char ch, unsigned int seed) {
+    if (!m_board) m_board = new Board<H, W>(ch, seed);
     m_board->delay_ms = delay;
 }
 
-void Frame::start() {
-    int action, result;
+template <int H, int W>
+void Frame<H, W>::start() {
+    Scheduler sched;
+
+    spawn(sched);
+    sched.run();
+}
 
+/* add the tasks of an interactive game, sched runs them */
+template <int H, int W>
+void Frame<H, W>::spawn(Scheduler &sched) {
+    m_sched = &sched;
+    m_dirty = Event(&sched);
+    m_resume = Event(&sched);
     reset_timer();
     m_board->new_block();
-    while (m_board->is_game_over() == false) {
-
-        action = MOVE_NONE;
+    m_dirty.set(); /* the first screen */
+    sched.spawn(input_task(), this);
+    sched.spawn(gravity_task(), this);
+    sched.spawn(render_task(), this);
+}
 
-        Sleep(1); /* sleep a while */
-        if (_dbg) Sleep(100);
+/* add an autoplayer game, lock guards every change of the board */
+template <int H, int W>
+void Frame<H, W>::spawn_auto(Scheduler &sched, const double *weights, GameLock *lock, const std::atomic<bool> *stop) {
+    m_sched = &sched;
+    lock->lock();
+    m_board->new_block();
+    m_board->update_game_over();
+    lock->unlock();
+    sched.spawn(auto_task(weights, lock, stop), this);
+}
 
-        if (kbhit()) { //kbhit returns a non-zero integer if a key is in the keyboard buffer.
-            action = get_user_input();
-            if (action >= MOVE_L1 && action <= MOVE_L5) {
-                m_board->delay_ms = level2delay(action + 1 - MOVE_L1);
-                continue;
-            }
-            if (MOVE_HINT == action) {
-                _tips = !_tips;
-                continue;
-            }
-            if (MOVE_QUIT == action) {
+template <int H, int W>
+Task Frame<H, W>::auto_task(const double *weights, GameLock *lock, const std::atomic<bool> *stop) {
+    int rotation, pos_x;
+    long long deadline;
+
+    while (!*stop) {
+        {
+            std::lock_guard<GameLock> guard(*lock);
+            if (m_board->is_game_over()) break;
+            if (m_board->find_placement(weights, rotation, pos_x)) {
+                place_block(rotation, pos_x);
+            } else {
                 m_board->set_game_over();
-                continue;
             }
-            if (MOVE_PAUSE == action) {
-                m_board->set_game_pause();
+        }
+        /* one block per level delay, the other games of this thread go on meanwhile */
+        deadline = get_ms() + m_board->delay_ms;
+        while (!*stop && get_ms() < deadline) {
+            co_await m_sched->until(std::min(deadline, get_ms() + 100));
+        }
+    }
+}
+
+/* the other tasks of this game see the game is over and return */
+template <int H, int W>
+void Frame<H, W>::finish() {
+    m_dirty.set();
+    m_resume.set();
+    m_sched->wake(this);
+}
+
+template <int H, int W>
+void Frame<H, W>::toggle_pause() {
+    m_board->set_game_pause();
+    if (!m_board->is_game_pause()) m_resume.set();
+}
+
+template <int H, int W>
+Task Frame<H, W>::input_task() {
+    size_t i;
+    int n, result;
+    long long deadline;
+    bool dirty;
+
+    while (m_board->is_game_over() == false) {
+        /* a held key repeats without any new input */
+        deadline = das_deadline();
+        co_await m_sched->input(deadline);
+
+        poll_user_input();
+        if (m_board->is_game_over()) {
+            break;
+        }
+        if (m_board->is_game_pause()) {
+            continue;
+        }
+
+        dirty = false;
+        for (i = 0; i < m_runs.size() && !m_board->is_game_over(); i++) {
+            if (MOVE_UNDO == m_runs[i].action) {
+                if (m_board->undo(m_runs[i].count)) dirty = true;
+                reset_timer();
+                continue;
             }
-            else if (m_board->is_game_pause() && action >= MOVE_ROTATE && action <= MOVE_DOWN) {
-                m_board->set_game_pause();
+            for (n = 0; n < m_runs[i].count; n++) {
+                if (MOVE_DOWN == m_runs[i].action) {
+                    reset_timer();
+                }
+                result = play_action(m_runs[i].action);
+                /* the rest of a blocked shift or rotation would collide as well */
+                if (result == STAT_COLLIDE) break;
+                dirty = true;
+                if (m_board->is_game_over()) break;
             }
         }
-        if (is_timeout(m_board->delay_ms)) {
-            action = MOVE_DOWN;
+        if (dirty) {
+            m_dirty.set();
+        }
+    }
+    finish();
+}
+
+template <int H, int W>
+Task Frame<H, W>::gravity_task() {
+    while (m_board->is_game_over() == false) {
+        /* the deadline moves whenever the block is pushed down by hand */
+        co_await m_sched->until(m_timer + m_board->delay_ms + 1);
+        if (m_board->is_game_over()) {
+            break;
         }
         if (m_board->is_game_pause()) {
-            action = MOVE_NONE;
+            /* sleep until the game goes on, the block gets a full delay then */
+            co_await m_resume.wait();
+            reset_timer();
+            continue;
         }
-        if (MOVE_NONE == action) {
+        if (!is_timeout(m_board->delay_ms)) {
             continue;
         }
-        if (MOVE_DOWN == action) {
-            reset_timer();
+        reset_timer();
+        play_action(MOVE_DOWN);
+        m_dirty.set();
+    }
+    finish();
+}
+
+template <int H, int W>
+Task Frame<H, W>::render_task() {
+    do {
+        co_await m_dirty.wait();
+        m_board->refresh_screen();
+    } while (m_board->is_game_over() == false);
+}
+
+template <int H, int W>
+void Frame<H, W>::push_input(int action, int count) {
+    if (!m_runs.empty() && m_runs.back().action == action) {
+        m_runs.back().count += count;
+        return;
+    }
+    InputRun run = {action, count};
+    m_runs.push_back(run);
+}
+
+/* drain all pending keys, coalescing moves into m_runs */
+template <int H, int W>
+void Frame<H, W>::poll_user_input() {
+    int key, action;
+    long long now = get_ms();
+
+    m_runs.clear();
+    while ((key = read_key()) >= 0) {
+        action = get_user_input(key);
+        if (action >= MOVE_L1 && action <= MOVE_L5) {
+            m_board->delay_ms = level2delay(action + 1 - MOVE_L1);
+            continue;
         }
-        result = m_board->move_block(action);
-        if (result == STAT_STOP) {
-            m_board->free_block();
-            m_board->clear_line();
-            m_board->refresh_screen();
-            m_board->new_block();
-            m_board->move_block(MOVE_NONE); /* used to check game-over */
+        if (MOVE_HINT == action) {
+            _tips = !_tips;
+            continue;
         }
-        m_board->refresh_screen();
+        if (MOVE_QUIT == action) {
+            m_board->set_game_over();
+            return;
+        }
+        if (MOVE_PAUSE == action) {
+            toggle_pause();
+            continue;
+        }
+        if ((action < MOVE_ROTATE || action > MOVE_DOWN) && action != MOVE_UNDO) {
+            continue;
+        }
+        if (m_board->is_game_pause()) {
+            toggle_pause();
+        }
+        if ((MOVE_LEFT == action || MOVE_RIGHT == action) && !das_key(action, now)) {
+            continue;
+        }
+        push_input(action, 1);
+    }
+    das_repeat(now);
+}
+
+/*
+ * Terminals report no key release, only the OS autorepeat of a held key:
+ * a first repeat after a delay of 250-660 ms, then one every 30-50 ms.
+ * Every press shifts once. A key up to _key_delay_ms after a press may be
+ * its first repeat or another tap: it shifts once as well, unless it came
+ * within the DAS delay of the press, then it waits to see which it was.
+ * More keys within KEY_RELEASE_MS mean the key is held since the press; the
+ * repeats are swallowed, and from the press plus DAS the engine shifts
+ * every ARR ms until no repeat was seen for KEY_RELEASE_MS. So neither the
+ * delay nor the rate of the OS repeat change the speed.
+ * return false if the key is swallowed by the engine autorepeat
+ */
+template <int H, int W>
+bool Frame<H, W>::das_key(int action, long long now) {
+    long long gap = now - m_das_seen;
+
+    if (m_das_dir == action && m_das_state != DAS_PRESSED && gap <= KEY_RELEASE_MS) {
+        m_das_state = DAS_HELD;
+        m_das_pending = false;
+        m_das_seen = now;
+        return false;
+    }
+    if (m_das_dir == action && m_das_state == DAS_PRESSED && gap > KEY_RELEASE_MS && gap <= _key_delay_ms) {
+        m_das_state = DAS_FIRST;
+        m_das_first = m_das_seen = now;
+        m_das_pending = now - m_das_press < _das_ms;
+        return !m_das_pending;
     }
+    m_das_dir = action;
+    m_das_state = DAS_PRESSED;
+    m_das_pending = false;
+    m_das_auto = false;
+    m_das_press = m_das_seen = now;
+    return true;
 }
 
-void Frame::print_result() {
+template <int H, int W>
+void Frame<H, W>::das_repeat(long long now) {
+    if (MOVE_NONE == m_das_dir || DAS_PRESSED == m_das_state) return;
+    if (now - m_das_seen > KEY_RELEASE_MS) {
+        if (DAS_FIRST == m_das_state) {
+            /* it was a tap, which counts as the press of the next key */
+            if (m_das_pending) push_input(m_das_dir, 1);
+            m_das_state = DAS_PRESSED;
+            m_das_press = m_das_first;
+            m_das_pending = false;
+        } else {
+            m_das_dir = MOVE_NONE;
+            m_das_auto = false;
+        }
+        return;
+    }
+    if (!m_das_auto) {
+        if (DAS_HELD != m_das_state || now < m_das_press + _das_ms) return;
+        m_das_auto = true;
+        /* a first repeat after the DAS delay already shifted */
+        if (m_das_first - m_das_press >= _das_ms) m_das_next = m_das_first + _arr_ms;
+        else m_das_next = m_das_press + _das_ms;
+    }
+    if (_arr_ms <= 0) {
+        push_input(m_das_dir, m_board->width());
+        return;
+    }
+    while (m_das_next <= now) {
+        push_input(m_das_dir, 1);
+        m_das_next += _arr_ms;
+    }
+}
+
+/* when a held key needs the engine without any new input, -1 never */
+template <int H, int W>
+long long Frame<H, W>::das_deadline() {
+    long long deadline;
+
+    if (MOVE_NONE == m_das_dir || DAS_PRESSED == m_das_state) return -1;
+    deadline = m_das_seen + KEY_RELEASE_MS + 1;
+    if (DAS_HELD != m_das_state) return deadline;
+    if (!m_das_auto) return std::min(deadline, m_das_press + _das_ms);
+    if (_arr_ms > 0) return std::min(deadline, m_das_next);
+    return deadline;
+}
+
+/* apply one move, lock the block and spawn the next one when it lands */
+template <int H, int W>
+int Frame<H, W>::play_action(int action) {
+    int result = m_board->move_block(action);
+    if (result == STAT_STOP) {
+        m_board->lock_block();
+    }
+    return result;
+}
+
+template <int H, int W>
+void Frame<H, W>::place_block(int rotation, int pos_x) {
+    int type, rota, y, x, i;
+
+    if (!m_board->get_block_info(type, rota, y, x)) return;
+    for (i = 0; i < DIRECT_NUM && rota != rotation; i++) {
+        if (play_action(MOVE_ROTATE) != STAT_NORMAL) break;
+        m_board->get_block_info(type, rota, y, x);
+    }
+    while (x != pos_x) {
+        if (play_action(x < pos_x ? MOVE_RIGHT : MOVE_LEFT) != STAT_NORMAL) break;
+        m_board->get_block_info(type, rota, y, x);
+    }
+    while (play_action(MOVE_DOWN) == STAT_NORMAL);
+}
+
+/* return false to quit */
+template <int H, int W>
+bool Frame<H, W>::pipe_command(const char *cmd) {
+    int rotation, pos_x, count;
+    const char *key;
+
+    switch (cmd[0]) {
+    case 'P':
+        if (!m_board->is_game_over() && sscanf(cmd + 1, "%d %d", &rotation, &pos_x) == 2) {
+            place_block(rotation, pos_x);
+        }
+        break;
+    case 'A':
+        for (key = cmd + 1; *key && !m_board->is_game_over(); key++) {
+            switch (*key) {
+            case 'w':
+                play_action(MOVE_ROTATE);
+                break;
+            case 'a':
+                play_action(MOVE_LEFT);
+                break;
+            case 'd':
+                play_action(MOVE_RIGHT);
+                break;
+            case 's':
+                play_action(MOVE_DOWN);
+                break;
+            case 'x':
+                while (play_action(MOVE_DOWN) == STAT_NORMAL);
+                break;
+            }
+        }
+        break;
+    case 'U':
+        if (sscanf(cmd + 1, "%d", &count) == 1) {
+            m_board->undo(count);
+        }
+        break;
+    case 'Q':
+        return false;
+    default:
+        debug("unknown command %s", cmd);
+        break;
+    }
+    return true;
+}
+
+template <int H, int W>
+void Frame<H, W>::start_pipe() {
+    char cmd[1024];
+
+    m_board->new_block();
+    m_board->update_game_over();
+    while (true) {
+        /* a lost game waits for an undo, e.g. of a backtracking search */
+        if (m_board->is_game_over()) printf("O %d\n", m_board->get_score());
+        else m_board->put_state(stdout);
+        fflush(stdout);
+        if (!fgets(cmd, sizeof(cmd), stdin)) break;
+        if (!pipe_command(cmd)) break;
+    }
+}
+
+/*
+ * headless replay of one recorded game, bot commands up to 'Q'; the board is
+ * rendered to memory after every command, return the commands replayed
+ */
+template <int H, int W>
+int Frame<H, W>::start_replay(FILE *fp, unsigned int &checksum) {
+    std::vector<char> buffer(m_board->width() * 2 + 1, 0);
+    char cmd[1024];
+    int commands = 0, i, j;
+
+    m_board->new_block();
+    m_board->update_game_over();
+    while (fgets(cmd, sizeof(cmd), fp)) {
+        if (cmd[0] == '#' || cmd[0] == '\n') continue;
+        if (!pipe_command(cmd)) break;
+        commands++;
+        for (i = 0; i < m_board->height(); i++) {
+            m_board->render_line(i, 0, m_board->width(), buffer.data());
+            for (j = 0; j < m_board->width() * 2; j++) checksum = checksum * 31 + (unsigned char)buffer[j];
+        }
+    }
+    return commands;
+}
+
+/* headless game of the autoplayer, return the lines cleared */
+template <int H, int W>
+int Frame<H, W>::start_auto(const double *weights, int max_blocks, GameLock *lock,
+                            const std::atomic<bool> *stop) {
+    int rotation, pos_x, blocks;
+
+    if (lock) lock->lock();
+    m_board->new_block();
+    m_board->update_game_over();
+    for (blocks = 0; blocks < max_blocks && !m_board->is_game_over(); blocks++) {
+        if (!m_board->find_placement(weights, rotation, pos_x)) break;
+        place_block(rotation, pos_x);
+        /* a dashboard may look at the board between two blocks */
+        if (lock) {
+            lock->unlock();
+            lock->lock();
+        }
+        if (stop && *stop) break;
+    }
+    if (lock) lock->unlock();
+    return m_board->get_score();
+}
+
+template <int H, int W>
+void Frame<H, W>::print_result() {
     m_board->refresh_screen(false);
 }
-int Frame::get_user_input() {
-    char key;
-    key = getch();
 
+template <int H, int W>
+int Frame<H, W>::get_user_input(int key) {
     switch (key) {
     case CHR_RIGHT:
     case 'd': //right
@@ -857,6 +2524,8 @@ int Frame::get_user_input() {
         return MOVE_PAUSE;
     case 'q': //quit
         return MOVE_QUIT;
+    case 'u': //undo
+        return MOVE_UNDO;
     case '1': //Level-1
         return MOVE_L1;
     case '2': //Level-2
@@ -871,23 +2540,511 @@ int Frame::get_user_input() {
     return MOVE_NONE;
 }
 
-bool Frame::is_timeout(int delay) {
-    struct timeval now;
-    mingw_gettimeofday(&now, NULL);
-    return ((now.tv_sec - m_timer.tv_sec)*1000L + (now.tv_usec - m_timer.tv_usec)/1000L) > delay;
+template <int H, int W>
+bool Frame<H, W>::is_timeout(int delay) {
+    return get_ms() - m_timer > delay;
+}
+
+template <int H, int W>
+void Frame<H, W>::reset_timer() {
+    m_timer = get_ms();
+}
+
+////////////////////////////////////////////////////////
+/*
+ * Grid of live autoplayer games in one terminal. The games run on other
+ * threads: its own games of the '-w' weights as tasks on one Scheduler per
+ * core, each placing a block per level delay, or the games of a batch such
+ * as a Tuner, which show() each game in a tile while it plays. The main
+ * thread composes every tile into a single frame at most fps times a second,
+ * and only holds the lock of a game while copying its rows, so watching does
+ * not slow the games down. A tile keeps the last rows of its game until the
+ * next one is shown, and the last frame stays until 'q'.
+ */
+template <int H = 0, int W = 0>
+class Dashboard
+{
+public:
+    Dashboard(int games, int fps, int delay, char ch, unsigned int seed);
+    Dashboard(int tiles, int fps);
+    ~Dashboard();
+    void start();
+    int tiles() {return m_tiles.size();}
+    GameLock *show(int tile, Frame<H, W> *frame);
+    void set_status(const std::string &status);
+    const std::atomic<bool> *stop_flag() {return &m_stop;}
+
+private:
+    struct Tile {
+        Frame<H, W> *frame;
+        GameLock lock;
+    };
+    std::vector<Tile *> m_tiles;
+    bool m_own; /* the frames are its own games */
+    int m_fps;
+    std::atomic<bool> m_stop;
+    std::mutex m_status_lock;
+    std::string m_status;
+
+    void simulate(size_t first, size_t step);
+    bool compose(std::vector<std::string> &screen, int rows, int cols);
+};
+
+template <int H, int W>
+Dashboard<H, W>::Dashboard(int games, int fps, int delay, char ch, unsigned int seed) {
+    int i;
+    m_own = true;
+    m_fps = fps;
+    m_stop = false;
+    for (i = 0; i < games; i++) {
+        Tile *tile = new Tile;
+        tile->frame = new Frame<H, W>(delay, ch, seed + i);
+        m_tiles.push_back(tile);
+    }
+}
+
+/* empty tiles for the games of a batch, see show() */
+template <int H, int W>
+Dashboard<H, W>::Dashboard(int tiles, int fps) {
+    int i;
+    m_own = false;
+    m_fps = fps;
+    m_stop = false;
+    for (i = 0; i < tiles; i++) {
+        Tile *tile = new Tile;
+        tile->frame = NULL;
+        m_tiles.push_back(tile);
+    }
+}
+
+template <int H, int W>
+Dashboard<H, W>::~Dashboard() {
+    size_t i;
+    for (i = 0; i < m_tiles.size(); i++) {
+        if (m_own) delete m_tiles[i]->frame;
+        delete m_tiles[i];
+    }
+}
+
+/*
+ * Show frame in tile from any thread, NULL before the frame is gone. The
+ * game must hold the returned lock while it changes the board.
+ */
+template <int H, int W>
+GameLock *Dashboard<H, W>::show(int tile, Frame<H, W> *frame) {
+    Tile *t = m_tiles[tile];
+    std::lock_guard<GameLock> guard(t->lock);
+    t->frame = frame;
+    return &t->lock;
+}
+
+template <int H, int W>
+void Dashboard<H, W>::set_status(const std::string &status) {
+    std::lock_guard<std::mutex> guard(m_status_lock);
+    m_status = status;
+}
+
+/* thread body: every step-th game from first, multiplexed on one scheduler */
+template <int H, int W>
+void Dashboard<H, W>::simulate(size_t first, size_t step) {
+    Scheduler sched;
+    size_t i;
+
+    for (i = first; i < m_tiles.size(); i += step) {
+        m_tiles[i]->frame->spawn_auto(sched, _weights, &m_tiles[i]->lock, &m_stop);
+    }
+    sched.run();
+}
+
+/* return false once every game is over, or no game is shown */
+template <int H, int W>
+bool Dashboard<H, W>::compose(std::vector<std::string> &screen, int rows, int cols) {
+    Board<H, W> *board;
+    int view_h = 0, view_w = 0, tile_h, tile_w, grid_x, grid_y;
+    size_t i, shown;
+    int row, x, y, score, total = 0;
+    bool running = false;
+    char title[64];
+    std::string status;
+    std::vector<char> buffer;
+
+    if ((int)screen.size() != rows || (rows > 0 && (int)screen[0].size() != cols)) {
+        screen.assign(rows, std::string(cols, ' '));
+    }
+    /* all games have the size of the board of run_game() */
+    for (i = 0; i < m_tiles.size() && view_h == 0; i++) {
+        std::lock_guard<GameLock> guard(m_tiles[i]->lock);
+        if (!m_tiles[i]->frame) continue;
+        board = m_tiles[i]->frame->get_board();
+        view_h = std::min(board->height(), rows - 2);
+        view_w = std::min(board->width(), cols / 2);
+    }
+    tile_h = view_h + 1;
+    tile_w = view_w * 2 + 1;
+    grid_x = std::max(1, cols / tile_w);
+    grid_y = std::max(1, (rows - 1) / tile_h);
+    shown = std::min(m_tiles.size(), (size_t)(grid_x * grid_y));
+    buffer.assign(view_w * 2 + 1, 0);
+
+    for (i = 0; i < m_tiles.size() && view_h > 0; i++) {
+        Tile *tile = m_tiles[i];
+        tile->lock.lock_view();
+        if (!tile->frame) {
+            tile->lock.unlock();
+            continue;
+        }
+        board = tile->frame->get_board();
+        score = board->get_score();
+        total += score;
+        if (!board->is_game_over()) running = true;
+        if (i < shown) {
+            x = (i % grid_x) * tile_w;
+            y = (i / grid_x) * tile_h;
+            snprintf(title, sizeof(title), "#%d L%d %d%s", (int)i, delay2level(board->delay_ms), score,
+                     board->is_game_over() ? " over" : "");
+            screen[y].replace(x, view_w * 2, view_w * 2, ' ');
+            screen[y].replace(x, std::min((int)strlen(title), view_w * 2), title,
+                              std::min((int)strlen(title), view_w * 2));
+            /* the bottom of a tall board, where the stack is */
+            for (row = 0; row < view_h; row++) {
+                board->render_line(board->height() - view_h + row, 0, view_w, buffer.data());
+                screen[y + 1 + row].replace(x, view_w * 2, buffer.data(), view_w * 2);
+            }
+        }
+        tile->lock.unlock();
+    }
+    if (m_own) {
+        snprintf(title, sizeof(title), "games %d, shown %d, lines %d%s", (int)m_tiles.size(), (int)shown,
+                 total, running ? "" : ", all over");
+        status = title;
+    } else {
+        std::lock_guard<std::mutex> guard(m_status_lock);
+        status = m_status;
+    }
+    status += ", 'q' to quit";
+    screen[rows - 1].assign(cols, ' ');
+    screen[rows - 1].replace(0, std::min((int)status.size(), cols), status, 0, std::min((int)status.size(), cols));
+    return running;
 }
 
-void Frame::reset_timer() {
-    mingw_gettimeofday(&m_timer, NULL);
+/* until 'q', which also stops the games */
+template <int H, int W>
+void Dashboard<H, W>::start() {
+    std::vector<std::thread> workers;
+    std::vector<std::string> screen;
+    unsigned int n = std::thread::hardware_concurrency();
+    size_t i;
+    int rows, cols, y;
+
+    n = std::max(1u, std::min(n, (unsigned int)m_tiles.size()));
+    for (i = 0; i < n && m_own; i++) {
+        workers.push_back(std::thread(&Dashboard::simulate, this, i, (size_t)n));
+    }
+
+    init_curses();
+    while (read_key() != 'q') {
+        get_view_size(rows, cols);
+        compose(screen, rows, cols);
+#ifdef _WIN32
+        system("cls");
+        for (y = 0; y < rows - 1; y++) printf("%s\n", screen[y].c_str());
+        printf("%s", screen[rows - 1].c_str());
+#else
+        erase();
+        for (y = 0; y < rows; y++) mvaddnstr(y, 0, screen[y].c_str(), cols - (y == rows - 1));
+        refresh();
+#endif
+        Sleep(1000 / m_fps);
+    }
+    m_stop = true;
+    for (i = 0; i < workers.size(); i++) workers[i].join();
+    exit_curses();
+
+    for (i = 0; i < m_tiles.size() && m_own; i++) {
+        std::cout << "game " << i << ": " << m_tiles[i]->frame->get_board()->get_score() << " lines\n";
+    }
 }
 
 ////////////////////////////////////////////////////////
+#define TUNE_POPULATION 40
+#define TUNE_ELITE      8
+#define TUNE_GAMES      8
+#define TUNE_BLOCKS     1000
+
+/*
+ * Cross-entropy tuning of the autoplayer weights. Every generation samples
+ * TUNE_POPULATION candidates around the mean, scores each one by the average
+ * lines of TUNE_GAMES seeded headless games spread over all cores, and refits
+ * mean and deviation to the best TUNE_ELITE candidates. The state is saved to
+ * the checkpoint file after each generation, so a stopped run resumes there.
+ * A watching Dashboard shows the game of each of its first threads.
+ */
+template <int H = 0, int W = 0>
+class Tuner
+{
+public:
+    Tuner(const char *file, unsigned int seed);
+    void start(int generations);
+    void watch(Dashboard<H, W> *dashboard) {m_dash = dashboard;}
+
+private:
+    Dashboard<H, W> *m_dash = NULL;
+    std::string m_file;
+    unsigned int m_seed;
+    int m_generation;
+    double m_mean[FEAT_NUM];
+    double m_dev[FEAT_NUM];
+    double m_best[FEAT_NUM];
+    double m_best_score;
+
+    bool load();
+    void save();
+    void play_all(const std::vector<double> &weights, std::vector<double> &scores);
+};
+
+template <int H, int W>
+Tuner<H, W>::Tuner(const char *file, unsigned int seed) {
+    int i;
+    m_file = file;
+    m_seed = seed;
+    m_generation = 0;
+    m_best_score = -1;
+    for (i = 0; i < FEAT_NUM; i++) {
+        m_mean[i] = m_best[i] = _weights[i];
+        m_dev[i] = 0.5;
+    }
+    if (load()) {
+        std::cout << "resume from " << m_file << ", generation " << m_generation << std::endl;
+    }
+}
+
+template <int H, int W>
+bool Tuner<H, W>::load() {
+    FILE *fp = fopen(m_file.c_str(), "r");
+    int i, n = 0;
+
+    if (!fp) return false;
+    n += fscanf(fp, "generation %d seed %u\n", &m_generation, &m_seed);
+    n += fscanf(fp, "best %lf", &m_best_score);
+    for (i = 0; i < FEAT_NUM; i++) n += fscanf(fp, "%lf", &m_best[i]);
+    n += fscanf(fp, " mean");
+    for (i = 0; i < FEAT_NUM; i++) n += fscanf(fp, "%lf", &m_mean[i]);
+    n += fscanf(fp, " dev");
+    for (i = 0; i < FEAT_NUM; i++) n += fscanf(fp, "%lf", &m_dev[i]);
+    fclose(fp);
+    if (n != 3 + FEAT_NUM * 3) {
+        std::cout << "bad checkpoint " << m_file << std::endl;
+        exit(1);
+    }
+    return true;
+}
+
+/* write a new file and rename it, so a stop while saving keeps the old one */
+template <int H, int W>
+void Tuner<H, W>::save() {
+    std::string tmp = m_file + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    int i;
+
+    if (!fp) return;
+    fprintf(fp, "generation %d seed %u\nbest %.6f", m_generation, m_seed, m_best_score);
+    for (i = 0; i < FEAT_NUM; i++) fprintf(fp, " %.6f", m_best[i]);
+    fprintf(fp, "\nmean");
+    for (i = 0; i < FEAT_NUM; i++) fprintf(fp, " %.6f", m_mean[i]);
+    fprintf(fp, "\ndev");
+    for (i = 0; i < FEAT_NUM; i++) fprintf(fp, " %.6f", m_dev[i]);
+    fprintf(fp, "\n");
+    fclose(fp);
+#ifdef _WIN32
+    remove(m_file.c_str());
+#endif
+    rename(tmp.c_str(), m_file.c_str());
+}
+
+/*
+ * weights holds FEAT_NUM values per candidate. All candidates of a generation
+ * play the same seeds, the games are shared out to one thread per core.
+ */
+template <int H, int W>
+void Tuner<H, W>::play_all(const std::vector<double> &weights, std::vector<double> &scores) {
+    size_t count = weights.size() / FEAT_NUM;
+    std::vector<int> lines(count * TUNE_GAMES);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    unsigned int seed = m_seed + m_generation * TUNE_GAMES;
+    size_t i, g;
+
+    unsigned int n = std::thread::hardware_concurrency();
+    for (i = 0; i < (n ? n : 1); i++) {
+        workers.push_back(std::thread([&, i]() {
+            bool shown = m_dash && (int)i < m_dash->tiles();
+            GameLock *lock = NULL;
+            size_t job;
+            while ((job = next++) < lines.size()) {
+                Frame<H, W> frame(level2delay(0), '#', seed + job % TUNE_GAMES);
+                if (shown) lock = m_dash->show(i, &frame);
+                lines[job] = frame.start_auto(&weights[job / TUNE_GAMES * FEAT_NUM], TUNE_BLOCKS,
+                                              lock, m_dash ? m_dash->stop_flag() : NULL);
+                if (shown) m_dash->show(i, NULL);
+            }
+        }));
+    }
+    for (i = 0; i < workers.size(); i++) workers[i].join();
+
+    scores.assign(count, 0);
+    for (i = 0; i < count; i++) {
+        for (g = 0; g < TUNE_GAMES; g++) scores[i] += lines[i * TUNE_GAMES + g];
+        scores[i] /= TUNE_GAMES;
+    }
+}
+
+template <int H, int W>
+void Tuner<H, W>::start(int generations) {
+    std::vector<double> weights(TUNE_POPULATION * FEAT_NUM), scores;
+    std::vector<int> order(TUNE_POPULATION);
+    int i, j, k, end = m_generation + generations;
+    char report[256] = "";
+    size_t len;
+
+    while (m_generation < end) {
+        if (m_dash) {
+            /* the report of the previous generation stays beside the progress */
+            m_dash->set_status("tuning generation " + std::to_string(m_generation + 1) + " of " +
+                               std::to_string(end) + (*report ? "; " : "") + report);
+        }
+        std::mt19937 rng(m_seed + m_generation);
+        for (i = 0; i < TUNE_POPULATION; i++) {
+            for (j = 0; j < FEAT_NUM; j++) {
+                std::normal_distribution<double> dist(m_mean[j], m_dev[j]);
+                weights[i * FEAT_NUM + j] = dist(rng);
+            }
+        }
+        play_all(weights, scores);
+        /* the games of a stopped generation are cut short, it is not saved */
+        if (m_dash && *m_dash->stop_flag()) break;
+
+        for (i = 0; i < TUNE_POPULATION; i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [&](int a, int b) {return scores[a] > scores[b];});
+        if (scores[order[0]] > m_best_score) {
+            m_best_score = scores[order[0]];
+            for (j = 0; j < FEAT_NUM; j++) m_best[j] = weights[order[0] * FEAT_NUM + j];
+        }
+        for (j = 0; j < FEAT_NUM; j++) {
+            double mean = 0, var = 0;
+            for (k = 0; k < TUNE_ELITE; k++) mean += weights[order[k] * FEAT_NUM + j];
+            mean /= TUNE_ELITE;
+            for (k = 0; k < TUNE_ELITE; k++) {
+                double d = weights[order[k] * FEAT_NUM + j] - mean;
+                var += d * d;
+            }
+            m_mean[j] = mean;
+            /* a little noise keeps the search from collapsing too early */
+            m_dev[j] = sqrt(var / TUNE_ELITE) + 0.01;
+        }
+        m_generation++;
+        save();
+
+        len = snprintf(report, sizeof(report), "generation %d: top %.1f, elite %.1f lines, best -w ",
+                       m_generation, scores[order[0]], scores[order[TUNE_ELITE - 1]]);
+        for (j = 0; j < FEAT_NUM; j++) {
+            len += snprintf(report + len, sizeof(report) - len, "%s%.3f", j ? "," : "", m_best[j]);
+        }
+        /* curses owns the terminal of a dashboard, it shows the report instead */
+        if (m_dash) {
+            m_dash->set_status(std::string(report) + (m_generation == end ? "; done" : ""));
+        } else {
+            printf("%s\n", report);
+            fflush(stdout);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////
+/*
+ * Replay a recorded workload, "G <seed>" starts a game and bot commands up to
+ * "Q" play it, see train/selfplay.txt. No curses and no pacing: it times the
+ * hot paths of the game, and is the training run of 'make pgo'.
+ */
+template <int H, int W>
+static void run_replay(const char *file, int delay, char block_ch) {
+    FILE *fp = fopen(file, "r");
+    unsigned int seed, checksum = 0;
+    int games = 0, commands = 0, score = 0;
+    long long start = get_us();
+    char line[1024];
+
+    if (!fp) {
+        fprintf(stderr, "can not open %s\n", file);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "G %u", &seed) != 1) continue;
+        Frame<H, W> m_frame(delay, block_ch, seed);
+        commands += m_frame.start_replay(fp, checksum);
+        score += m_frame.get_board()->get_score();
+        games++;
+    }
+    fclose(fp);
+    printf("replay: %d games, %d commands, %d lines, checksum %08x, %lld us\n",
+           games, commands, score, checksum, get_us() - start);
+}
+
+template <int H, int W>
+static void run_game(int delay, char block_ch, unsigned int seed, bool pipe_mode) {
+    if (_replay_file) {
+        run_replay<H, W>(_replay_file, delay, block_ch);
+        return;
+    }
+    if (_tune_file && _dash_games > 0) {
+        /* the tuner runs beside the dashboard, which owns the terminal until 'q' */
+        Tuner<H, W> tuner(_tune_file, seed);
+        Dashboard<H, W> dashboard(_dash_games, _dash_fps);
+        tuner.watch(&dashboard);
+        std::thread tuning([&]() {tuner.start(_tune_generations);});
+        dashboard.start();
+        tuning.join();
+        return;
+    }
+    if (_dash_games > 0) {
+        Dashboard<H, W> dashboard(_dash_games, _dash_fps, delay, block_ch, seed);
+        dashboard.start();
+        return;
+    }
+    if (_tune_file) {
+        Tuner<H, W> tuner(_tune_file, seed);
+        tuner.start(_tune_generations);
+        return;
+    }
+    /* only a played game has a board, an unplayed one would be logged */
+    Frame<H, W> m_frame(delay, block_ch, seed);
+
+    if (pipe_mode) {
+        m_frame.start_pipe();
+        return;
+    }
+    init_curses();
+
+    m_frame.start(); //start game
+
+    exit_curses();
+#ifndef _WIN32
+    m_frame.print_result(); //end game
+#endif
+
+    std::cout << "===============\n"
+                 "~~~Game Over~~~\n"
+                 "===============\n";
+}
+
 int main(int argc, char *argv[]) {
     int level, delay = level2delay(0), help = 0;
     char c, block_ch = 177;
-    int height = 0, width = 0, x;
+    int height = 0, width = 0, x, i;
+    bool pipe_mode = false;
+    char *end;
+    unsigned int seed = time(NULL);
     std::string str;
-    while ((c = getopt(argc, argv, "dhtl:c:s:")) != -1) {
+    while ((c = getopt(argc, argv, "dhtbl:c:s:r:D:A:K:w:T:g:m:f:R:L:S:")) != -1) {
         switch (c) {
         case 'l':
             level = (uint32_t) atoi(optarg);
@@ -906,9 +3063,9 @@ int main(int argc, char *argv[]) {
                 width = atoi(str.substr(x + 1).c_str());
                 debug("height = %d, width = %d", height, width);
             }
-            if (height >= 10 && height <= 50) HEIGHT = height;
+            if (height >= 10 && height <= 10000) HEIGHT = height;
             else help = 1;
-            if (width >= 8 && width <= 40) WIDTH = width;
+            if (width >= 8 && width <= 1000) WIDTH = width;
             else help = 1;
             break;
         case 'd':
@@ -917,6 +3074,54 @@ int main(int argc, char *argv[]) {
         case 't':
             _tips = true;
             break;
+        case 'r':
+            seed = (unsigned int) strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            pipe_mode = true;
+            break;
+        case 'D':
+            _das_ms = atoi(optarg);
+            if (_das_ms < 0) help = 1;
+            break;
+        case 'A':
+            _arr_ms = atoi(optarg);
+            if (_arr_ms < 0) help = 1;
+            break;
+        case 'K':
+            _key_delay_ms = atoi(optarg);
+            if (_key_delay_ms <= KEY_RELEASE_MS) help = 1;
+            break;
+        case 'w':
+            for (i = 0, end = optarg; i < FEAT_NUM; i++, end++) {
+                _weights[i] = strtod(end, &end);
+                if (*end != (i < FEAT_NUM - 1 ? ',' : '\0')) break;
+            }
+            if (i < FEAT_NUM) help = 1;
+            break;
+        case 'T':
+            _tune_file = optarg;
+            break;
+        case 'g':
+            _tune_generations = atoi(optarg);
+            if (_tune_generations < 1) help = 1;
+            break;
+        case 'm':
+            _dash_games = atoi(optarg);
+            if (_dash_games < 1) help = 1;
+            break;
+        case 'f':
+            _dash_fps = atoi(optarg);
+            if (_dash_fps < 1 || _dash_fps > 1000) help = 1;
+            break;
+        case 'R':
+            _replay_file = optarg;
+            break;
+        case 'L':
+            _log_file = optarg;
+            break;
+        case 'S':
+            exit(Telemetry::print_stats(optarg) ? 0 : 1);
         case 'h':
         default:
             help = 1;
@@ -924,27 +3129,47 @@ int main(int argc, char *argv[]) {
     }
 
     if (help) {
-        std::cout << argv[0] << " [-s HxW] [-l level] [-c char] [-t]\n"
-                                "  size:  \theight[10, 50], width[8, 40], default 20x15\n"
+        std::cout << argv[0] << " [-s HxW] [-l level] [-c char] [-t] [-r seed] [-b] [-D das] [-A arr]\n"
+                                "      [-K delay] [-w weights] [-T file] [-g generations] [-m games] [-f fps]\n"
+                                "      [-R workload] [-L log] [-S log]\n"
+                                "  size:  \theight[10, 10000], width[8, 1000], default 20x15\n"
                                 "  level: \t[1, 5] is supported, default 3\n"
                                 "  char:  \tblock shape char, default 177\n"
-                                "  tips:  \tenable preview of next block\n";
+                                "  tips:  \tenable preview of next block\n"
+                                "  seed:  \trandom seed, default current time\n"
+                                "  bot:   \tbot pipe mode on stdin/stdout\n"
+                                "  das:   \tdelayed auto shift in ms, default 170\n"
+                                "  arr:   \tauto repeat rate in ms, 0 for instant, default 50\n"
+                                "  delay: \tlongest delay of the terminal before a held key repeats,\n"
+                                "         \tin ms, default 660\n"
+                                "  weights:\tautoplayer weights of holes,heights,bumpiness,wells,lines\n"
+                                "  file:  \ttune the weights by self-play, checkpoint to file\n"
+                                "  generations:\tgenerations to tune, default 20\n"
+                                "  games: \tdashboard of autoplayer games in one terminal,\n"
+                                "         \twith -T the games of the tuning run\n"
+                                "  fps:   \tdashboard refreshes per second, default 10\n"
+                                "  workload:\treplay recorded games headless and time them\n"
+                                "  log:   \t-L appends telemetry of every block and game to log,\n"
+                                "         \t-S prints a summary of log\n";
         exit(0);
     }
 
-    srand(time(NULL));
-    init_curses();
-
-    Frame m_frame(delay, block_ch);
-    m_frame.start(); //start game
-
-    exit_curses();
-#ifndef _WIN32
-    m_frame.print_result(); //end game
-#endif
+    if (_log_file) {
+        _telemetry = new Telemetry(_log_file);
+        if (!_telemetry->is_open()) {
+            fprintf(stderr, "can not open %s\n", _log_file);
+            exit(1);
+        }
+    }
 
-    std::cout << "===============\n"
-                 "~~~Game Over~~~\n"
-                 "===============\n";
+    /* the default and the standard 10x20 playfield get constant loop bounds */
+    if (HEIGHT == 20 && WIDTH == 15) {
+        run_game<20, 15>(delay, block_ch, seed, pipe_mode);
+    } else if (HEIGHT == 21 && WIDTH == 12) {
+        run_game<21, 12>(delay, block_ch, seed, pipe_mode);
+    } else {
+        run_game<0, 0>(delay, block_ch, seed, pipe_mode);
+    }
+    delete _telemetry;
     exit(0);
 }